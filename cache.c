@@ -0,0 +1,174 @@
+/**
+ * This module keeps results that are expensive to work out, so they can be given again
+ * when the same question is asked. A cache is made with newCache, holding at most the
+ * number of results it was made with. cacheFind looks up the value stored for a key and
+ * cacheAdd stores one, dropping the result used least recently when the cache is full.
+ * Keys and values are copied into the cache, so the caller's copies can be reused.
+ *
+ * Each cache counts the lookups that found a result (hits) and those that did not
+ * (misses).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "dataStore.h"
+
+/**
+ * @brief Make a new, empty cache
+ * @param capacity most results the cache holds, at least 1
+ * @return struct cache* the cache, to be freed with freeCache
+ */
+struct cache* newCache(int capacity) {
+    struct cache* c = calloc(1, sizeof(struct cache));
+    if (!c) {
+        perror("Failed to allocate cache");
+        exit(EXIT_FAILURE);
+    }
+
+    // At most half full, so chains stay short
+    c->table_size = 1;
+    while (c->table_size < (uint32_t) capacity * 2) {
+        c->table_size *= 2;
+    }
+
+    c->table = calloc(c->table_size, sizeof(struct cache_entry*));
+    if (!c->table) {
+        perror("Failed to allocate cache table");
+        exit(EXIT_FAILURE);
+    }
+
+    c->capacity = capacity;
+
+    return c;
+}
+
+/**
+ * @brief Find the value stored for a key, which becomes the most recently used
+ * @param key bytes of the key
+ * @param key_size number of bytes in the key
+ * @return char* the value, held by the cache until the next call to cacheAdd, or NULL
+ * when the cache has none for the key
+ */
+char* cacheFind(struct cache* c, char *key, size_t key_size) {
+    uint64_t hash = checksum(CHECKSUM_BASIS, key, key_size);
+
+    struct cache_entry* e = c->table[hash & (c->table_size - 1)];
+    while (e && (e->hash != hash || e->key_size != key_size || memcmp(e->key, key, key_size) != 0)) {
+        e = e->next;
+    }
+
+    if (!e) {
+        c->misses++;
+        return NULL;
+    }
+    c->hits++;
+
+    // Move to the front of the list
+    if (c->newest != e) {
+        e->newer->older = e->older;
+        if (e->older) {
+            e->older->newer = e->newer;
+        } else {
+            c->oldest = e->newer;
+        }
+
+        e->newer = NULL;
+        e->older = c->newest;
+        c->newest->newer = e;
+        c->newest = e;
+    }
+
+    return e->value;
+}
+
+/**
+ * @brief Store a value for a key that the cache does not have. When the cache is full,
+ * the result used least recently is dropped to make room
+ * @param key bytes of the key
+ * @param key_size number of bytes in the key
+ * @param value bytes of the value
+ * @param value_size number of bytes in the value
+ */
+void cacheAdd(struct cache* c, char *key, size_t key_size, char *value, size_t value_size) {
+    if (c->num == c->capacity) {
+        struct cache_entry* oldest = c->oldest;
+        unlinkEntry(c, oldest);
+        free(oldest);
+    }
+
+    size_t value_at = (sizeof(struct cache_entry) + key_size + 7) / 8 * 8;
+    struct cache_entry* e = malloc(value_at + value_size);
+    if (!e) {
+        perror("Failed to allocate cache entry");
+        exit(EXIT_FAILURE);
+    }
+
+    e->hash = checksum(CHECKSUM_BASIS, key, key_size);
+    e->key = (char *) (e + 1);
+    e->key_size = key_size;
+    e->value = (char *) e + value_at;
+    e->value_size = value_size;
+    memcpy(e->key, key, key_size);
+    memcpy(e->value, value, value_size);
+
+    // Add to its slot and the front of the list
+    struct cache_entry** slot = c->table + (e->hash & (c->table_size - 1));
+    e->next = *slot;
+    *slot = e;
+
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest) {
+        c->newest->newer = e;
+    } else {
+        c->oldest = e;
+    }
+    c->newest = e;
+
+    c->num++;
+}
+
+/**
+ * @brief Take an entry out of a cache's table and list without freeing it
+ */
+void unlinkEntry(struct cache* c, struct cache_entry* e) {
+    struct cache_entry** slot = c->table + (e->hash & (c->table_size - 1));
+    while (*slot != e) {
+        slot = &((*slot)->next);
+    }
+    *slot = e->next;
+
+    if (e->newer) {
+        e->newer->older = e->older;
+    } else {
+        c->newest = e->older;
+    }
+    if (e->older) {
+        e->older->newer = e->newer;
+    } else {
+        c->oldest = e->newer;
+    }
+
+    c->num--;
+}
+
+/**
+ * @brief Free a cache and every result in it
+ */
+void freeCache(struct cache* c) {
+    if (!c) {
+        return;
+    }
+
+    struct cache_entry* e = c->newest;
+    while (e) {
+        struct cache_entry* older = e->older;
+        free(e);
+        e = older;
+    }
+
+    free(c->table);
+    free(c);
+}
@@ -0,0 +1,53 @@
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Number of results kept by a cache unless asked for otherwise
+#define CACHE_DEFAULT_SIZE 4096
+
+// One result kept by a cache. The key and the value are held in the same allocation,
+// the value starting at the first multiple of 8 bytes after the key
+struct cache_entry {
+    uint64_t hash;
+    char *key;
+    size_t key_size;
+    char *value;
+    size_t value_size;
+
+    // Next entry in the same slot of the table
+    struct cache_entry *next;
+
+    // Neighbours in the list of entries from most to least recently used
+    struct cache_entry *newer;
+    struct cache_entry *older;
+};
+
+// Bounded map from keys to values, both any bytes. Once full, adding a result drops the
+// one used least recently
+struct cache {
+    // Chained hash table of the entries, its size a power of two
+    struct cache_entry **table;
+    uint32_t table_size;
+
+    // Ends of the list of entries by use
+    struct cache_entry *newest;
+    struct cache_entry *oldest;
+
+    int num;
+    int capacity;
+
+    // Number of lookups that found a result and that did not
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct cache* newCache(int capacity);
+char* cacheFind(struct cache* c, char *key, size_t key_size);
+void cacheAdd(struct cache* c, char *key, size_t key_size, char *value, size_t value_size);
+void unlinkEntry(struct cache* c, struct cache_entry* e);
+void freeCache(struct cache* c);
+
+#endif
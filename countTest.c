@@ -0,0 +1,157 @@
+/**
+ * Test program for the solver's --count mode, counting a puzzle's solutions the plain way.
+ * Call with the puzzle file name and, optionally, the directory of the dictionary's store
+ * (default "data").
+ *
+ * Every word of each code word's bucket is tried in turn, kept if it agrees with the
+ * letters found so far and uses no letter another code letter already has. None of the
+ * solver's pruning, caching or guessing is used, so its count can be checked against
+ * this one. The count is printed as the solver prints it: "Solutions found: n".
+ */
+
+#include "puzzel.h"
+#include "data.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Words of each code word's bucket, len letters each one after another
+struct candidates {
+    struct cwrd* cw;
+    char *words;
+    uint64_t num;
+};
+
+int fewerWords(const void *a, const void *b);
+uint64_t count(struct candidates* c, int n, char *known, uint32_t used);
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        printf("Usage: $ %s <puzzle_file> [dir]\n", argv[0]);
+        return -1;
+    }
+
+    struct data_store* store = argc == 3 ? loadDictionary(argv[2], argv[2]) : init();
+    struct puzzle* puzzle = parse(argv[1], store);
+
+    int n = 0;
+    while (puzzle->cwrds[n]) {
+        n++;
+    }
+
+    struct candidates* c = calloc(n + 1, sizeof(struct candidates));
+    if (!c) {
+        perror("Failed to allocate candidates");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every word in each bucket, with no letters known or ruled out
+    struct cursor* reader = newCursor(store);
+    for (int i = 0; i < n; i++) {
+        struct cwrd* cw = puzzle->cwrds[i];
+        char none[cw->len];
+        memset(none, 0, cw->len);
+
+        uint64_t size = 0;
+        c[i].cw = cw;
+        cursorBucket(reader, cw->bucket, none, 0);
+
+        char *word;
+        while (word = cursorNext(reader)) {
+            if (c[i].num == size) {
+                size = size ? size * 2 : 64;
+                c[i].words = realloc(c[i].words, size * cw->len);
+                if (!c[i].words) {
+                    perror("Failed to allocate words");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            memcpy(c[i].words + c[i].num * cw->len, word, cw->len);
+            c[i].num++;
+        }
+    }
+    freeCursor(reader);
+
+    // Code words with the fewest words first, so a wrong choice is found sooner
+    qsort(c, n, sizeof(struct candidates), fewerWords);
+
+    // The letters given with the puzzle are already used
+    char known[26];
+    uint32_t used = 0;
+    memcpy(known, puzzle->known, 26);
+    for (int i = 0; i < 26; i++) {
+        if (known[i]) {
+            used |= 0x1 << (known[i] - 'a');
+        }
+    }
+
+    printf("Solutions found: %" PRIu64 "\n", count(c, n, known, used));
+
+    for (int i = 0; i < n; i++) {
+        free(c[i].words);
+    }
+    free(c);
+    freePuzzle(puzzle);
+    freeDictionaries();
+
+    return 0;
+}
+
+/**
+ * @brief Order code words by their number of words, fewest first
+ */
+int fewerWords(const void *a, const void *b) {
+    const struct candidates* x = a;
+    const struct candidates* y = b;
+    return (x->num > y->num) - (x->num < y->num);
+}
+
+/**
+ * @brief Count the ways of giving the code words from the first on words that agree with
+ * each other and with the letters known so far
+ * @param c the code words left, each with every word of its bucket
+ * @param n number of code words left
+ * @param known letter found for each code letter, zero when none has been
+ * @param used set of the letters found for any code letter
+ * @return uint64_t the number of solutions
+ */
+uint64_t count(struct candidates* c, int n, char *known, uint32_t used) {
+    if (n == 0) {
+        return 1;
+    }
+
+    struct cwrd* cw = c->cw;
+    uint64_t total = 0;
+
+    for (uint64_t w = 0; w < c->num; w++) {
+        char *word = c->words + w * cw->len;
+
+        // Words of a bucket repeat their letters where the code word repeats its code
+        // letters, so each code letter only needs checking where it is first found
+        char now[26];
+        uint32_t now_used = used;
+        memcpy(now, known, 26);
+
+        int i = 0;
+        while (i < cw->len) {
+            int clet = cw->clets[i] - 1;
+            uint32_t letter = 0x1 << (word[i] - 'a');
+
+            if (now[clet] ? now[clet] != word[i] : (now_used & letter) != 0) {
+                break;
+            }
+
+            now[clet] = word[i];
+            now_used |= letter;
+            i++;
+        }
+
+        if (i == cw->len) {
+            total += count(c + 1, n - 1, now, now_used);
+        }
+    }
+
+    return total;
+}
@@ -1,39 +1,159 @@
 
 /**
- * The data module is responsible for reading from the word list.
- * The method init must be called before reading.
- * The method newPattern must be called to start a new search through the list.
- * After newPattern, nextWord will return the location of the next word in the list.
+ * The data module is responsible for reading from the word lists.
+ * Any number of dictionaries can be loaded, each a store read once from its own
+ * directory and known by a name. The method loadDictionary loads one (or gives the one
+ * already loaded with that name) and findDictionary looks one up by name. The method
+ * init loads the default dictionary from the directory "data".
+ * The method findPattern gives the number of the bucket holding a pattern's words in a
+ * dictionary, and loadBucket starts reading a bucket that is going to be searched.
+ * The method newBucket (or newPattern, which finds the bucket itself) must be called to
+ * start a new search through a dictionary's list.
+ * After newBucket, nextWord will return the location of the next word in the list.
+ *
+ * Each search keeps its state in a cursor. newBucket, newPattern and nextWord use one
+ * shared cursor; newCursor makes another, searched with cursorBucket, cursorPattern and
+ * cursorNext. Stores are only read by a search, so any number of cursors can search one
+ * store at once from different threads, each cursor used by one thread at a time.
+ * Dictionaries must be loaded before the threads start.
+ *
+ * Buckets which have letter posting bitsets are searched by combining the bitsets of the
+ * known letters 64 words at a time, so only the words that match are visited. Other
+ * buckets are scanned. A bucket's words in the base store are read first, followed by
+ * any that delta segments add.
+ *
+ * Scanned buckets are read 64 words at a time by a kernel chosen for the processor when
+ * a dictionary is loaded: AVX2 or SSE2 where the processor has them, or a plain loop.
+ * A block of words is compared with the known letters repeated for every word, giving a
+ * bitset of the bytes that differ, and from that a bitset of the words that match. The
+ * words after the last whole block are compared one at a time.
+ *
+ * When the store has its words stored by position, a segment without postings is
+ * searched by comparing only the columns of the known letters, 64 words at a time with
+ * the same kind of kernel. The words returned are still read from the words file, or
+ * unpacked when the store has none.
+ *
+ * When the store has packed words, 5 bits per letter, the scan compares them with the
+ * known letters 12 letters at a time without unpacking them. Only the words returned
+ * are unpacked, into a buffer that is reused by the next call to nextWord.
+ *
+ * The method wordWeight gives the weight of the word nextWord last returned, such as
+ * how often it is used, or 1 when the store has no weights.
+ *
+ * The method bucketSummary gives what searching a bucket with no known letters or
+ * excluded letters would find, when the store has it worked out already.
  * 
  * This module also provides a method generatePattern for generating a pattern from
  * a letter string
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "data.h"
 
-// Location in memory of the start of the next word to be read
-char* current;
+#if SCAN_SIMD
+#include <immintrin.h>
+#endif
 
-// Location in memory of the first word after the last word to be read in this pattern.
-// When current equals end, the pattern has no more words to be read
-char* end;
+// Dictionaries loaded so far, in the order they were loaded
+struct dictionary* dictionaries = NULL;
+int num_dictionaries = 0;
+int dictionaries_size = 0;
 
-// Length of pattern/word currently being used
-int len;
+// Cursor searched by newBucket, newPattern, nextWord and wordWeight, made by the first
+// search
+struct cursor* search = NULL;
 
-// Array holding the known letters for this pattern in the places they occur.
-char *known;
+// Kernel comparing a block of 64 words with the known letters. The plain loop is used
+// until chooseScanner picks the fastest the processor can run
+uint64_t (*scanBlock)(struct cursor* c, char *words) = scanBlockScalar;
 
-// The structure holding the list of words and patterns.
-// Must be initialised first
-struct data_store* data_store;
+// Kernel finding which of 64 letters of a column are a letter, chosen in the same way
+uint64_t (*matchColumn)(char *column, char letter) = matchColumnScalar;
 
 /**
- * @brief Initialise the data store. Must be called before any other function in this module
+ * @brief Load the default dictionary from the directory "data"
+ * @return struct data_store* the default dictionary's store
  */
-void init() {
-    data_store = read();
+struct data_store* init() {
+    return loadDictionary(DEFAULT_DICTIONARY, "data");
+}
+
+/**
+ * @brief Load a dictionary and give it a name. Each dictionary is only loaded once:
+ * loading a name again gives the store already loaded, as long as it is from the same
+ * directory. Stores are only read from, so one can be shared by every search
+ * @param name name to find the dictionary by
+ * @param dir directory holding the dictionary's store, made by makeData
+ * @return struct data_store* the dictionary's store
+ */
+struct data_store* loadDictionary(char *name, char *dir) {
+    struct data_store* ds = findDictionary(name);
+    if (ds) {
+        if (strcmp(ds->dir, dir) != 0) {
+            printf("Dictionary '%s' is already loaded from '%s', not '%s'\n", name, ds->dir, dir);
+            exit(EXIT_FAILURE);
+        }
+
+        return ds;
+    }
+
+    if (num_dictionaries == dictionaries_size) {
+        dictionaries_size = dictionaries_size ? dictionaries_size * 2 : 4;
+        dictionaries = realloc(dictionaries, dictionaries_size * sizeof(struct dictionary));
+        if (!dictionaries) {
+            perror("Failed to allocate dictionaries");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct dictionary* d = dictionaries + num_dictionaries;
+    d->name = malloc(strlen(name) + 1);
+    if (!d->name) {
+        perror("Failed to allocate dictionary name");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(d->name, name);
+    d->store = readStore(dir);
+
+    // Done before any search, so never changes while one is running
+    chooseScanner();
+
+    num_dictionaries++;
+
+    return d->store;
+}
+
+/**
+ * @brief Find a dictionary that has been loaded by its name
+ * @return struct data_store* the dictionary's store, or NULL if none has the name
+ */
+struct data_store* findDictionary(char *name) {
+    for (int i = 0; i < num_dictionaries; i++) {
+        if (strcmp(dictionaries[i].name, name) == 0) {
+            return dictionaries[i].store;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Free every dictionary that has been loaded
+ */
+void freeDictionaries() {
+    for (int i = 0; i < num_dictionaries; i++) {
+        free(dictionaries[i].name);
+        freeDataStore(dictionaries[i].store);
+    }
+
+    free(dictionaries);
+    dictionaries = NULL;
+    num_dictionaries = 0;
+    dictionaries_size = 0;
+
+    freeCursor(search);
+    search = NULL;
 }
 
 /**
@@ -102,41 +222,740 @@ char* generatePattern(char *string, char len) {
 }
 
 /**
- * @brief Set a new pattern to search through.
- * Calling this method indicates the search for words will continue for this new pattern.
- * This will start reading from the start of this pattern.
+ * @brief Find the bucket of words belonging to a pattern.
+ * Uses the hash table built when the store was loaded, so takes the same time however
+ * many patterns there are.
+ * @param ds Dictionary to look in, or NULL for none
  * @param n Number of characters in pattern
  * @param base Basic pattern holds information about letter duplication
+ * @return int number of the pattern's bucket, or -1 if no words have this pattern
+ */
+int findPattern(struct data_store* ds, int n, char *base) {
+    if (!ds) {
+        return -1;
+    }
+
+    return lookupPattern(ds, n, base);
+}
+
+/**
+ * @brief Start reading what searching a bucket reads in the background, ahead of it
+ * being searched. Used with a store that is read lazily
+ * @param ds Dictionary holding the bucket, or NULL for none
+ * @param bucket Bucket number given by findPattern for the dictionary. A negative number is an empty bucket
+ * @param summary 1 if the bucket's summary will be asked for by bucketSummary
+ */
+void loadBucket(struct data_store* ds, int bucket, char summary) {
+    if (!ds || bucket < 0) {
+        return;
+    }
+
+    loadPattern(ds, bucket, summary);
+}
+
+/**
+ * @brief Get the summary of every word in a bucket: the letters found at each position
+ * and the weights behind them, laid out as in the summary file
+ * @param ds Dictionary holding the bucket
+ * @param bucket Bucket number given by findPattern for the dictionary. A negative number is an empty bucket
+ * @return uint64_t* the summary, or NULL when the words must be searched instead. Buckets
+ * that delta segments add words to have none, as the summary only covers the base store
+ */
+uint64_t* bucketSummary(struct data_store* ds, int bucket) {
+    if (bucket < 0) {
+        return NULL;
+    }
+
+    struct pattern* p = ds->patterns + bucket;
+    return p->next ? NULL : p->summary;
+}
+
+/**
+ * @brief Make a new cursor for searching a dictionary. The cursor has no search until
+ * cursorBucket or cursorPattern is called
+ * @param ds Dictionary the cursor searches
+ * @return struct cursor* the cursor, to be freed with freeCursor
+ */
+struct cursor* newCursor(struct data_store* ds) {
+    struct cursor* c = calloc(1, sizeof(struct cursor));
+    if (!c) {
+        perror("Failed to allocate cursor");
+        exit(EXIT_FAILURE);
+    }
+
+    c->store = ds;
+
+    return c;
+}
+
+/**
+ * @brief Free a cursor and the buffers it has used. The store is not freed
+ */
+void freeCursor(struct cursor* c) {
+    if (!c) {
+        return;
+    }
+
+    free(c->filters);
+    free(c->columns);
+    free(c->column_letters);
+    free(c->chunk_offset);
+    free(c->chunk_mask);
+    free(c->chunk_value);
+    free(c->unpacked);
+    free(c->scan_value);
+    free(c->scan_mask);
+    free(c->scan_bad);
+    free(c);
+}
+
+/**
+ * @brief Set a new bucket to search through.
+ * Calling this method indicates the search for words will continue for this new bucket.
+ * This will start reading from the start of this bucket.
+ * Words are only returned if their letters in the positions that are not filled in are
+ * all outside the used set. These letters already decode other code letters, so cannot
+ * be used again.
+ * @param ds Dictionary to search
+ * @param bucket Bucket number given by findPattern for the dictionary. A negative number is an empty bucket
  * @param filled Array of characters which have already been filled in, entries set to zero when not filled
+ * @param used Set of letters already decoded in the puzzle, which may include the filled in letters
+ */
+void newBucket(struct data_store* ds, int bucket, char *filled, uint32_t used) {
+    if (!search) {
+        search = newCursor(ds);
+    }
+
+    search->store = ds;
+    cursorBucket(search, bucket, filled, used);
+}
+
+/**
+ * @brief Set a new bucket for a cursor to search through, as newBucket does for the
+ * shared search. The filled in letters are read during the search so must not change
+ * until it is finished
+ * @param c Cursor to search with
+ * @param bucket Bucket number given by findPattern for the cursor's dictionary. A negative number is an empty bucket
+ * @param filled Array of characters which have already been filled in, entries set to zero when not filled
+ * @param used Set of letters already decoded in the puzzle, which may include the filled in letters
+ */
+void cursorBucket(struct cursor* c, int bucket, char *filled, uint32_t used) {
+    c->known = filled;
+    c->num_filters = 0;
+    c->num_columns = 0;
+    c->scanning = 0;
+    c->segment = NULL;
+    c->packed = NULL;
+
+    // Patterns without any words leave nothing to read
+    if (bucket < 0) {
+        c->current = c->end = NULL;
+        return;
+    }
+
+    struct pattern* p = c->store->patterns + bucket;
+    c->len = p->len;
+
+    // Words in a bucket all have the same pattern, so a filled in letter only appears in
+    // the positions it was filled in. Any other used letter rules a word out
+    c->exclude = used;
+    for (int i = 0; i < c->len; i++) {
+        if (c->known[i] >= 'a' && c->known[i] <= 'z') {
+            c->exclude &= ~(0x1 << (c->known[i] - 'a'));
+        }
+    }
+
+    newSegment(c, p);
+}
+
+/**
+ * @brief Start reading the words of one segment of the bucket: the base store's words
+ * or those a delta segment adds
+ */
+void newSegment(struct cursor* c, struct pattern* p) {
+    // Save start and end locations
+    c->segment = p;
+    c->current = p->start;
+    c->end = p->end;
+    c->bucket_start = p->start;
+    c->masks = p->masks;
+    c->weights = p->weights;
+
+    setFilters(c, p);
+    setColumns(c, p);
+    setPacked(c, p);
+    setScan(c, p);
+}
+
+/**
+ * @brief Prepare to compare the packed words of a segment with the known letters.
+ * Segments without packed words are read as bytes
+ */
+void setPacked(struct cursor* c, struct pattern* p) {
+    // Words found by their columns are read from the words file, unless there is none
+    c->packed = c->num_columns && !c->store->packed_only ? NULL : p->packed;
+    if (!c->packed) {
+        return;
+    }
+
+    c->packed_word = 0;
+    c->packed_num = (p->end - p->start) / p->len;
+
+    int chunks = (c->len + PACKED_LETTERS - 1) / PACKED_LETTERS;
+    if (c->chunks_size < chunks) {
+        c->chunk_offset = realloc(c->chunk_offset, chunks * sizeof(uint64_t));
+        c->chunk_mask = realloc(c->chunk_mask, chunks * sizeof(uint64_t));
+        c->chunk_value = realloc(c->chunk_value, chunks * sizeof(uint64_t));
+        if (!c->chunk_offset || !c->chunk_mask || !c->chunk_value) {
+            perror("Failed to allocate packed chunks");
+            exit(EXIT_FAILURE);
+        }
+        c->chunks_size = chunks;
+    }
+
+    if (c->unpacked_size < c->len) {
+        c->unpacked = realloc(c->unpacked, c->len);
+        if (!c->unpacked) {
+            perror("Failed to allocate unpacked word");
+            exit(EXIT_FAILURE);
+        }
+        c->unpacked_size = c->len;
+    }
+
+    c->num_chunks = 0;
+    for (int k = 0; k < chunks; k++) {
+        uint64_t mask = 0;
+        uint64_t value = 0;
+
+        for (int i = k * PACKED_LETTERS; i < c->len && i < (k + 1) * PACKED_LETTERS; i++) {
+            if (!c->known[i]) {
+                continue;
+            }
+
+            // Anything other than a letter is given a value no letter has, so never matches
+            uint64_t l = (c->known[i] >= 'a' && c->known[i] <= 'z') ? c->known[i] - 'a' : 31;
+            int shift = (i - k * PACKED_LETTERS) * PACKED_BITS;
+            mask |= (uint64_t) 31 << shift;
+            value |= l << shift;
+        }
+
+        if (mask) {
+            c->chunk_offset[c->num_chunks] = (uint64_t) k * PACKED_LETTERS * PACKED_BITS;
+            c->chunk_mask[c->num_chunks] = mask;
+            c->chunk_value[c->num_chunks] = value;
+            c->num_chunks++;
+        }
+    }
+}
+
+/**
+ * @brief Read 64 bits of the packed words starting at any bit.
+ * Bits past the end of the pattern's words are read from the unit after them
+ */
+uint64_t packedBits(struct cursor* c, uint64_t bit) {
+    uint64_t *unit = c->packed + bit / 64;
+    int shift = bit % 64;
+
+    if (!shift) {
+        return *unit;
+    }
+
+    return (unit[0] >> shift) | (unit[1] << (64 - shift));
+}
+
+/**
+ * @brief Check whether a packed word has the known letters.
+ * @param w number of the word in the segment
+ * @return char 1 if every known letter matches, 0 otherwise
+ */
+char matchPacked(struct cursor* c, uint64_t w) {
+    uint64_t bit = w * c->len * PACKED_BITS;
+
+    for (int k = 0; k < c->num_chunks; k++) {
+        if ((packedBits(c, bit + c->chunk_offset[k]) & c->chunk_mask[k]) != c->chunk_value[k]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Find the set of letters in a packed word
+ */
+uint32_t packedMask(struct cursor* c, uint64_t w) {
+    uint64_t bit = w * c->len * PACKED_BITS;
+    uint32_t mask = 0;
+
+    for (int i = 0; i < c->len; i += PACKED_LETTERS) {
+        uint64_t bits = packedBits(c, bit + (uint64_t) i * PACKED_BITS);
+        for (int j = i; j < c->len && j < i + PACKED_LETTERS; j++, bits >>= PACKED_BITS) {
+            mask |= 0x1 << (bits & 31);
+        }
+    }
+
+    return mask;
+}
+
+/**
+ * @brief Unpack a packed word into letters.
+ * @return char* the word, valid until the next word is unpacked
  */
-void newPattern(int n, char *base, char *filled) {
-    // Save parameters
-    len = n;
-    known = filled;
+char* unpackWord(struct cursor* c, uint64_t w) {
+    uint64_t bit = w * c->len * PACKED_BITS;
 
-    // Search for the correct pattern through the list
-    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
-        if (matchPattern(base, len, data_store->patterns + i)) {
-            // Pattern matches
+    for (int i = 0; i < c->len; i += PACKED_LETTERS) {
+        uint64_t bits = packedBits(c, bit + (uint64_t) i * PACKED_BITS);
+        for (int j = i; j < c->len && j < i + PACKED_LETTERS; j++, bits >>= PACKED_BITS) {
+            c->unpacked[j] = 'a' + (bits & 31);
+        }
+    }
 
-            // Save start and end locations
-            struct pattern* p = data_store->patterns + i;
-            current = p->start;
-            end = p->end;
+    return c->unpacked;
+}
 
-            // No need to continue searching
+/**
+ * @brief Choose the posting bitsets to search a bucket with.
+ * There are none if the bucket has no postings or no letters are known, in which case
+ * the bucket is scanned
+ */
+void setFilters(struct cursor* c, struct pattern* p) {
+    c->num_filters = 0;
+    if (!p->postings) {
+        return;
+    }
+
+    if (c->filters_size < p->len) {
+        c->filters = realloc(c->filters, p->len * sizeof(uint64_t*));
+        if (!c->filters) {
+            perror("Failed to allocate filters");
+            exit(EXIT_FAILURE);
+        }
+        c->filters_size = p->len;
+    }
+
+    // Positions in the same group have the same letter, so only one of them is used
+    uint32_t groups = 0;
+    for (int i = 0; i < c->len; i++) {
+        if (!c->known[i]) {
+            continue;
+        }
+
+        if (c->known[i] < 'a' || c->known[i] > 'z') {
+            // Not a letter the postings hold - scan instead
+            c->num_filters = 0;
             return;
         }
+
+        if (p->pattern[i]) {
+            uint32_t group = 0x1 << p->pattern[i];
+            if (groups & group) {
+                continue;
+            }
+            groups |= group;
+        }
+
+        c->filters[c->num_filters++] = p->postings + (i * 26 + (c->known[i] - 'a')) * p->blocks;
+    }
+
+    // Nothing to filter on - scan instead
+    if (!c->num_filters) {
+        return;
+    }
+
+    // Load the first block
+    c->blocks = p->blocks;
+    c->block = 0;
+    c->remaining = c->blocks ? filterBlock(c, 0) : 0;
+}
+
+/**
+ * @brief Combine the chosen bitsets for one block of 64 words.
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+uint64_t filterBlock(struct cursor* c, uint64_t b) {
+    uint64_t bits = c->filters[0][b];
+    for (int i = 1; i < c->num_filters && bits; i++) {
+        bits &= c->filters[i][b];
+    }
+
+    return bits;
+}
+
+/**
+ * @brief Choose the columns to search a segment stored by position with.
+ * There are none if the segment has no columns, is searched by its postings or no
+ * letters are known
+ */
+void setColumns(struct cursor* c, struct pattern* p) {
+    c->num_columns = 0;
+    if (!p->columns || c->num_filters) {
+        return;
+    }
+
+    if (c->columns_size < p->len) {
+        c->columns = realloc(c->columns, p->len * sizeof(char*));
+        c->column_letters = realloc(c->column_letters, p->len);
+        if (!c->columns || !c->column_letters) {
+            perror("Failed to allocate columns");
+            exit(EXIT_FAILURE);
+        }
+        c->columns_size = p->len;
+    }
+
+    uint64_t num = (p->end - p->start) / p->len;
+
+    // Every known position is compared, as a scan of the words would
+    for (int i = 0; i < c->len; i++) {
+        if (c->known[i] <= 0) {
+            continue;
+        }
+
+        c->columns[c->num_columns] = p->columns + i * num;
+        c->column_letters[c->num_columns] = c->known[i];
+        c->num_columns++;
+    }
+
+    // Nothing to compare - read every word instead
+    if (!c->num_columns) {
+        return;
+    }
+
+    // Load the first block. Letters read past the last word of a column are not words
+    c->blocks = (num + 63) / 64;
+    c->block = 0;
+    c->last_block = num % 64 ? ((uint64_t) 1 << (num % 64)) - 1 : ~(uint64_t) 0;
+    c->remaining = c->blocks ? columnBlock(c, 0) : 0;
+}
+
+/**
+ * @brief Compare the chosen columns for one block of 64 words.
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+uint64_t columnBlock(struct cursor* c, uint64_t b) {
+    uint64_t bits = b + 1 == c->blocks ? c->last_block : ~(uint64_t) 0;
+    for (int i = 0; i < c->num_columns && bits; i++) {
+        bits &= matchColumn(c->columns[i] + b * 64, c->column_letters[i]);
+    }
+
+    return bits;
+}
+
+/**
+ * @brief Find which of 64 letters of a column are a letter, one at a time
+ * @param column first of the 64 letters
+ * @return uint64_t bit i set when letter i is the letter given
+ */
+uint64_t matchColumnScalar(char *column, char letter) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 64; i++) {
+        bits |= (uint64_t) (column[i] == letter) << i;
+    }
+
+    return bits;
+}
+
+#if SCAN_SIMD
+/**
+ * @brief Find which of 64 letters of a column are a letter, 16 at a time
+ * @param column first of the 64 letters
+ * @return uint64_t bit i set when letter i is the letter given
+ */
+__attribute__((target("sse2")))
+uint64_t matchColumnSSE2(char *column, char letter) {
+    __m128i l = _mm_set1_epi8(letter);
+    uint64_t bits = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i letters = _mm_loadu_si128((__m128i *) (column + i * 16));
+        bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(letters, l)) << (i * 16);
+    }
+
+    return bits;
+}
+
+/**
+ * @brief Find which of 64 letters of a column are a letter, 32 at a time
+ * @param column first of the 64 letters
+ * @return uint64_t bit i set when letter i is the letter given
+ */
+__attribute__((target("avx2")))
+uint64_t matchColumnAVX2(char *column, char letter) {
+    __m256i l = _mm256_set1_epi8(letter);
+
+    __m256i low = _mm256_loadu_si256((__m256i *) column);
+    __m256i high = _mm256_loadu_si256((__m256i *) (column + 32));
+
+    uint64_t bits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, l));
+    return bits | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, l)) << 32;
+}
+#endif
+
+/**
+ * @brief Find the words in a block of 64 that have the known letters, by whichever of
+ * the postings, columns or a scan of the words the segment is searched with
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+uint64_t nextBlock(struct cursor* c, uint64_t b) {
+    if (c->num_filters) {
+        return filterBlock(c, b);
+    }
+
+    if (c->num_columns) {
+        return columnBlock(c, b);
+    }
+
+    return scanBlock(c, c->bucket_start + b * 64 * c->len);
+}
+
+/**
+ * @brief Prepare to scan the whole blocks of a segment's words with the scanning kernel.
+ * Only segments read as bytes without postings are scanned this way, and only when they
+ * have a whole block and any letters are known
+ */
+void setScan(struct cursor* c, struct pattern* p) {
+    c->scanning = 0;
+    if (c->num_filters || c->num_columns || c->packed) {
+        return;
+    }
+
+    uint64_t num = (p->end - p->start) / c->len;
+    char any = 0;
+    for (int i = 0; i < c->len; i++) {
+        any |= c->known[i] > 0;
+    }
+
+    if (num < 64 || !any) {
+        return;
+    }
+
+    if (c->scan_size < c->len) {
+        c->scan_value = realloc(c->scan_value, 64 * c->len);
+        c->scan_mask = realloc(c->scan_mask, 64 * c->len);
+        c->scan_bad = realloc(c->scan_bad, (c->len + 1) * sizeof(uint64_t));
+        if (!c->scan_value || !c->scan_mask || !c->scan_bad) {
+            perror("Failed to allocate scan masks");
+            exit(EXIT_FAILURE);
+        }
+        c->scan_size = c->len;
+    }
+
+    // Unknown positions are compared with zero under a zero mask, so always match. The
+    // first word is filled in then copied, doubling each time
+    for (int i = 0; i < c->len; i++) {
+        c->scan_value[i] = c->known[i] > 0 ? c->known[i] : 0;
+        c->scan_mask[i] = c->known[i] > 0 ? 0xff : 0;
+    }
+    for (int n = c->len; n < 64 * c->len; n *= 2) {
+        memcpy(c->scan_value + n, c->scan_value, n);
+        memcpy(c->scan_mask + n, c->scan_mask, n);
+    }
+    c->scan_bad[c->len] = 0;
+
+    // Load the first block, the words after the last whole block are compared one at a time
+    c->scanning = 1;
+    c->blocks = num / 64;
+    c->block = 0;
+    c->remaining = scanBlock(c, c->bucket_start);
+    c->current = c->bucket_start + c->blocks * 64 * c->len;
+}
+
+/**
+ * @brief Choose the fastest kernel for scanning blocks of words the processor can run
+ */
+void chooseScanner() {
+    scanBlock = scanBlockScalar;
+    matchColumn = matchColumnScalar;
+
+    #if SCAN_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanBlock = scanBlockAVX2;
+        matchColumn = matchColumnAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scanBlock = scanBlockSSE2;
+        matchColumn = matchColumnSSE2;
+    }
+    #endif
+}
+
+/**
+ * @brief Compare a block of 64 words with the known letters one word at a time
+ * @param words first word of the block
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+uint64_t scanBlockScalar(struct cursor* c, char *words) {
+    uint64_t bits = 0;
+
+    for (int w = 0; w < 64; w++, words += c->len) {
+        char ok = 1;
+        for (int i = 0; i < c->len; i++) {
+            if (c->known[i] > 0 && words[i] != c->known[i]) {
+                ok = 0;
+                break;
+            }
+        }
+
+        bits |= (uint64_t) ok << w;
+    }
+
+    return bits;
+}
+
+#if SCAN_SIMD
+/**
+ * @brief Compare a block of 64 words with the known letters 16 bytes at a time
+ * @param words first word of the block
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+__attribute__((target("sse2")))
+uint64_t scanBlockSSE2(struct cursor* c, char *words) {
+    // A block is 64 * len bytes, always a whole number of vectors
+    uint16_t *bad = (uint16_t *) c->scan_bad;
+    __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < 4 * c->len; i++) {
+        __m128i word = _mm_loadu_si128((__m128i *) (words + i * 16));
+        __m128i value = _mm_loadu_si128((__m128i *) (c->scan_value + i * 16));
+        __m128i mask = _mm_loadu_si128((__m128i *) (c->scan_mask + i * 16));
+
+        __m128i differ = _mm_and_si128(_mm_xor_si128(word, value), mask);
+        bad[i] = ~_mm_movemask_epi8(_mm_cmpeq_epi8(differ, zero));
+    }
+
+    return scannedWords(c);
+}
+
+/**
+ * @brief Compare a block of 64 words with the known letters 32 bytes at a time
+ * @param words first word of the block
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+__attribute__((target("avx2")))
+uint64_t scanBlockAVX2(struct cursor* c, char *words) {
+    uint32_t *bad = (uint32_t *) c->scan_bad;
+    __m256i zero = _mm256_setzero_si256();
+
+    for (int i = 0; i < 2 * c->len; i++) {
+        __m256i word = _mm256_loadu_si256((__m256i *) (words + i * 32));
+        __m256i value = _mm256_loadu_si256((__m256i *) (c->scan_value + i * 32));
+        __m256i mask = _mm256_loadu_si256((__m256i *) (c->scan_mask + i * 32));
+
+        __m256i differ = _mm256_and_si256(_mm256_xor_si256(word, value), mask);
+        bad[i] = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(differ, zero));
+    }
+
+    return scannedWords(c);
+}
+#endif
+
+/**
+ * @brief Turn the bitset of bytes that differ from a known letter in a block into the
+ * bitset of words that have none
+ * @return uint64_t bits set for the words in the block that have all known letters
+ */
+uint64_t scannedWords(struct cursor* c) {
+    uint64_t bits = 0;
+
+    // Most words fit in 64 bits read from the byte holding their first bit
+    if (c->len <= 56) {
+        unsigned char *bytes = (unsigned char *) c->scan_bad;
+        uint64_t mask = (0x1ULL << c->len) - 1;
+
+        for (int w = 0, bit = 0; w < 64; w++, bit += c->len) {
+            uint64_t piece;
+            memcpy(&piece, bytes + bit / 8, 8);
+            bits |= (uint64_t) !((piece >> (bit % 8)) & mask) << w;
+        }
+
+        return bits;
+    }
+
+    for (int w = 0; w < 64; w++) {
+        uint64_t bit = (uint64_t) w * c->len;
+        uint64_t differ = 0;
+
+        for (int n = c->len; n > 0 && !differ; n -= 64, bit += 64) {
+            int shift = bit % 64;
+            uint64_t piece = c->scan_bad[bit / 64] >> shift;
+            if (shift) {
+                piece |= c->scan_bad[bit / 64 + 1] << (64 - shift);
+            }
+
+            differ = n >= 64 ? piece : piece & ((0x1ULL << n) - 1);
+        }
+
+        bits |= (uint64_t) !differ << w;
+    }
+
+    return bits;
+}
+
+/**
+ * @brief Check a word which matches the known letters has no excluded letters.
+ * @param w number of the word in the bucket
+ * @param word the word, or NULL when the segment is packed
+ * @return char 1 if the word can be used, 0 otherwise
+ */
+char allowed(struct cursor* c, uint64_t w, char *word) {
+    if (!c->exclude) {
+        return 1;
+    }
+
+    // Use the stored letter set if there is one, otherwise work it out
+    uint32_t mask = 0;
+    if (c->masks) {
+        mask = c->masks[w];
+    } else if (c->packed) {
+        mask = packedMask(c, w);
+    } else {
+        for (int i = 0; i < c->len; i++) {
+            mask |= 0x1 << (word[i] - 'a');
+        }
     }
 
-    // If we got here, we didnt find a matching pattern
+    return (mask & c->exclude) == 0;
+}
 
-    printf("Error: unable to find pattern '");
-    for (int i = 0; i < n; i++) {
-        printf("%d ", *(base + i));
+/**
+ * @brief Find the position of the lowest set bit in a non-zero value
+ */
+int lowestBit(uint64_t bits) {
+    #ifdef __GNUC__
+    return __builtin_ctzll(bits);
+    #else
+    int n = 0;
+    while (!(bits & 0x1)) {
+        bits >>= 1;
+        n++;
     }
-    printf("' - aborting\n");
-    exit(EXIT_FAILURE);
+    return n;
+    #endif
+}
+
+/**
+ * @brief Set a new pattern to search through.
+ * Finds the pattern's bucket and starts reading from the start of it. When no words
+ * have the pattern the search is empty.
+ * @param ds Dictionary to search
+ * @param n Number of characters in pattern
+ * @param base Basic pattern holds information about letter duplication
+ * @param filled Array of characters which have already been filled in, entries set to zero when not filled
+ */
+void newPattern(struct data_store* ds, int n, char *base, char *filled) {
+    newBucket(ds, findPattern(ds, n, base), filled, 0);
+}
+
+/**
+ * @brief Set a new pattern for a cursor to search through, as newPattern does for the
+ * shared search.
+ * @param c Cursor to search with
+ * @param n Number of characters in pattern
+ * @param base Basic pattern holds information about letter duplication
+ * @param filled Array of characters which have already been filled in, entries set to zero when not filled
+ */
+void cursorPattern(struct cursor* c, int n, char *base, char *filled) {
+    cursorBucket(c, findPattern(c->store, n, base), filled, 0);
 }
 
 /**
@@ -162,16 +981,94 @@ char matchPattern(char *pattern, int len, struct pattern *p) {
 
 /**
  * @brief Get the next word for the current search.
- * @return char* Pointer to start of the next word or null if no more words remain
+ * @return char* Pointer to start of the next word or null if no more words remain. A word
+ * unpacked from packed words is only valid until the next call
  */
 char* nextWord() {
-    while (current != end) {
+    return search ? cursorNext(search) : NULL;
+}
+
+/**
+ * @brief Get the next word for a cursor's search.
+ * @return char* Pointer to start of the next word or null if no more words remain. A word
+ * unpacked from packed words is only valid until the cursor's next call
+ */
+char* cursorNext(struct cursor* c) {
+    char *word;
+    while (!(word = nextInSegment(c))) {
+        // Move on to any words a delta segment adds
+        if (!c->segment || !c->segment->next) {
+            return NULL;
+        }
+
+        newSegment(c, c->segment->next);
+    }
+
+    return word;
+}
+
+/**
+ * @brief Get the next word for the current search from the current segment.
+ * @return char* Pointer to start of the next word or null if no more words remain in the segment
+ */
+char* nextInSegment(struct cursor* c) {
+    while (c->num_filters || c->num_columns || c->scanning) {
+        // Return the words left in this block, then move through the blocks
+        if (!c->remaining) {
+            if (++c->block < c->blocks) {
+                c->remaining = nextBlock(c, c->block);
+                continue;
+            }
+
+            // Postings and columns cover every word, a scan leaves those after the last
+            // whole block
+            if (c->num_filters || c->num_columns) {
+                c->current = c->end;
+                c->packed_word = c->packed_num;
+            }
+            c->num_filters = 0;
+            c->num_columns = 0;
+            c->scanning = 0;
+            break;
+        }
+
+        uint64_t w = c->block * 64 + lowestBit(c->remaining);
+        c->remaining &= c->remaining - 1;
+
+        if (c->packed) {
+            if (allowed(c, w, NULL)) {
+                c->last_word = w;
+                return unpackWord(c, w);
+            }
+            continue;
+        }
+
+        char *word = c->bucket_start + w * c->len;
+        if (allowed(c, w, word)) {
+            c->last_word = w;
+            return word;
+        }
+    }
+
+    if (c->packed) {
+        while (c->packed_word < c->packed_num) {
+            uint64_t w = c->packed_word++;
+            if (matchPacked(c, w) && allowed(c, w, NULL)) {
+                c->last_word = w;
+                return unpackWord(c, w);
+            }
+        }
+
+        return NULL;
+    }
+
+    while (c->current != c->end) {
         // Check pattern matches known values
-        char *p = known;
+        char *p = c->known;
         char ok = 1;
-        for (int i = 0; i < len; i++, p++) {
+        for (int i = 0; i < c->len; i++, p++) {
             if (*p > 0) {
-                if (*(current + i) != *p) {
+                if (*(c->current + i) != *p) {
                     ok = 0;
                     break;
                 }
@@ -179,14 +1076,32 @@ char* nextWord() {
         }
 
         // Move to next
-        char* ret = current;
-        current += len;
+        char* ret = c->current;
+        c->current += c->len;
 
-        // If matched pattern, return word
-        if (ok) {
+        // If matched pattern and letters are allowed, return word
+        uint64_t w = (ret - c->bucket_start) / c->len;
+        if (ok && allowed(c, w, ret)) {
+            c->last_word = w;
             return ret;
         }
     }
 
     return NULL;
 }
+
+/**
+ * @brief Get the weight of the word last returned by nextWord
+ * @return uint32_t the word's weight, 1 if the store has no weights for it
+ */
+uint32_t wordWeight() {
+    return search ? cursorWeight(search) : 1;
+}
+
+/**
+ * @brief Get the weight of the word last returned by a cursor
+ * @return uint32_t the word's weight, 1 if the store has no weights for it
+ */
+uint32_t cursorWeight(struct cursor* c) {
+    return c->weights ? c->weights[c->last_word] : 1;
+}
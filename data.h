@@ -4,10 +4,153 @@
 
 #include "dataStore.h"
 
-void init();
+// Words scanned as bytes are compared with the known letters 64 at a time by a kernel
+// chosen when the program starts. Vector kernels are built for x86 with GCC or Clang
+// and used when the processor has the instructions, otherwise a plain loop is used
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_SIMD 1
+#else
+#define SCAN_SIMD 0
+#endif
+
+// Name of the dictionary loaded by init
+#define DEFAULT_DICTIONARY "default"
+
+// A store that has been loaded and the name it is known by
+struct dictionary {
+    char *name;
+    struct data_store *store;
+};
+
+// State of one search through a bucket of a dictionary
+struct cursor {
+    struct data_store* store; // dictionary being searched
+
+    // Location in memory of the start of the next word to be read, and of the first word
+    // after the last word to be read in this segment. When current equals end, the
+    // segment has no more words to be read
+    char* current;
+    char* end;
+
+    // Length of pattern/word currently being used
+    int len;
+
+    // Array holding the known letters for this pattern in the places they occur
+    char *known;
+
+    // Posting bitsets of the known letters when searching a bucket by its postings, one for
+    // each distinct known letter. The search scans the bucket when there are none
+    uint64_t **filters;
+    int num_filters;
+    int filters_size;
+
+    // Columns of the known letters when searching a segment stored by position, one for
+    // each known position, with the letter each must have. Searches by postings do not
+    // use them
+    char **columns;
+    char *column_letters;
+    int num_columns;
+    int columns_size;
+
+    // Set of letters which rule out a word when they appear in it, and the letter sets of the
+    // words in the segment (NULL when the store has none, so the sets are worked out)
+    uint32_t exclude;
+    uint32_t *masks;
+
+    // Weights of the words in the segment being searched, NULL when the store has none, and
+    // the number in the segment of the word last returned
+    uint32_t *weights;
+    uint64_t last_word;
+
+    // Segment of the bucket being searched. Its next segment is searched once it runs out
+    struct pattern* segment;
+
+    // Packed words of the segment being searched, NULL to read the words as bytes, with the
+    // number of the next word to check and the number of words in the segment
+    uint64_t *packed;
+    uint64_t packed_word;
+    uint64_t packed_num;
+
+    // Chunks of 12 letters of a packed word holding known letters. Each has its offset in
+    // bits from the start of the word, the mask of the known letters' bits and the value
+    // they must have
+    uint64_t *chunk_offset;
+    uint64_t *chunk_mask;
+    uint64_t *chunk_value;
+    int num_chunks;
+    int chunks_size;
+
+    // Letters of the last word returned from a packed segment
+    char *unpacked;
+    int unpacked_size;
+
+    // First word of the segment being searched, then for searches in blocks the number of
+    // blocks of 64 words in it, the current block and the bits for the words in it not yet
+    // returned
+    char *bucket_start;
+    uint64_t blocks;
+    uint64_t block;
+    uint64_t remaining;
+    uint64_t last_block; // bits for the words in the last block
+
+    // Set when the words of the segment are scanned in blocks, before the words after the
+    // last whole block are compared one at a time. Searches by postings use the same blocks
+    char scanning;
+
+    // Known letters repeated for each word of a block of 64, with the mask of the bytes that
+    // are known, and the bitset of bytes in the block that differ from a known letter. The
+    // bitset has a spare zero entry at the end
+    char *scan_value;
+    char *scan_mask;
+    uint64_t *scan_bad;
+    int scan_size;
+};
+
+struct data_store* init();
+struct data_store* loadDictionary(char *name, char *dir);
+struct data_store* findDictionary(char *name);
+void freeDictionaries();
 char* generatePattern(char *string, char len);
-void newPattern(int n, char *base, char *filled);
+int findPattern(struct data_store* ds, int n, char *base);
+void loadBucket(struct data_store* ds, int bucket, char summary);
+uint64_t* bucketSummary(struct data_store* ds, int bucket);
+struct cursor* newCursor(struct data_store* ds);
+void freeCursor(struct cursor* c);
+void newBucket(struct data_store* ds, int bucket, char *filled, uint32_t used);
+void cursorBucket(struct cursor* c, int bucket, char *filled, uint32_t used);
+void newSegment(struct cursor* c, struct pattern* p);
+void setFilters(struct cursor* c, struct pattern* p);
+void setPacked(struct cursor* c, struct pattern* p);
+uint64_t packedBits(struct cursor* c, uint64_t bit);
+char matchPacked(struct cursor* c, uint64_t w);
+uint32_t packedMask(struct cursor* c, uint64_t w);
+char* unpackWord(struct cursor* c, uint64_t w);
+uint64_t filterBlock(struct cursor* c, uint64_t b);
+void setColumns(struct cursor* c, struct pattern* p);
+uint64_t columnBlock(struct cursor* c, uint64_t b);
+uint64_t matchColumnScalar(char *column, char letter);
+#if SCAN_SIMD
+uint64_t matchColumnSSE2(char *column, char letter);
+uint64_t matchColumnAVX2(char *column, char letter);
+#endif
+uint64_t nextBlock(struct cursor* c, uint64_t b);
+void setScan(struct cursor* c, struct pattern* p);
+void chooseScanner();
+uint64_t scanBlockScalar(struct cursor* c, char *words);
+#if SCAN_SIMD
+uint64_t scanBlockSSE2(struct cursor* c, char *words);
+uint64_t scanBlockAVX2(struct cursor* c, char *words);
+#endif
+uint64_t scannedWords(struct cursor* c);
+char allowed(struct cursor* c, uint64_t w, char *word);
+int lowestBit(uint64_t bits);
+void newPattern(struct data_store* ds, int n, char *base, char *filled);
+void cursorPattern(struct cursor* c, int n, char *base, char *filled);
 char matchPattern(char *pattern, int len, struct pattern *p);
 char* nextWord();
+char* cursorNext(struct cursor* c);
+char* nextInSegment(struct cursor* c);
+uint32_t wordWeight();
+uint32_t cursorWeight(struct cursor* c);
 
 #endif
@@ -1,7 +1,19 @@
 /**
  * The data store module is responsible for parsing the processed data - the list
- * of words and its index. Call the method read to read the store.
- * 
+ * of words and its index. Call the method read to read the store in the directory
+ * "data", or readStore to read one from any directory.
+ *
+ * Both files are mapped read-only into memory rather than copied, so the words and
+ * patterns in the store are views into the page cache. Loading does not depend on
+ * the size of the dictionary and solvers running at the same time share one copy.
+ *
+ * A store can also be read lazily, for a program that only searches a few patterns.
+ * Reading ahead is then turned off so touching one bucket does not read its neighbours,
+ * and loadPattern starts reading just the buckets that will be searched.
+ *
+ * A store written with its words packed has no words file. Its words are read from the
+ * packed file, and patternWord gives the letters of any word whichever way it is held.
+ *
  * Compiles with link: '-l ws2_32'
  */
 
@@ -9,163 +21,1053 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
+#include <windows.h>
 #else
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 /**
- * @brief Load the data into a new data structure and return it
+ * @brief Load the data in the directory "data" into a new data structure and return it
  */
 struct data_store* read() {
+    return readStore("data");
+}
+
+/**
+ * @brief Load the store in a directory into a new data structure and return it.
+ * Any delta segments are layered on top of the base store
+ * @param dir directory holding the store's files
+ */
+struct data_store* readStore(char *dir) {
+    char *words_file = storeFile(dir, "words", 0);
+    char *index_file = storeFile(dir, "patternIndex", 0);
+
+    // The base store's words may be in the packed file instead
+    struct data_store* data_store = readSegment(words_file, index_file, 0);
+
+    free(words_file);
+    free(index_file);
+
+    // The optional files and delta segments are found in the same directory
+    data_store->dir = malloc(strlen(dir) + 1);
+    if (!data_store->dir) {
+        perror("Failed to allocate store directory");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(data_store->dir, dir);
+
+    indexPatterns(data_store);
+    readPostings(data_store);
+    readMasks(data_store);
+    readWeights(data_store);
+    readPacked(data_store);
+    checkPacked(data_store);
+    readColumns(data_store);
+    readSummary(data_store);
+    readDeltas(data_store);
+
+    return data_store;
+}
+
+/**
+ * @brief Load a words file and its pattern index into a new data structure, without
+ * any of the optional files or a lookup table
+ * @param required 1 to exit if the words file does not exist, 0 for a store whose words
+ * may be in its packed file instead
+ */
+struct data_store* readSegment(char *words_file, char *index_file, char required) {
     // Allocate memory
-    struct data_store* data_store = malloc(sizeof(struct data_store));
+    struct data_store* data_store = calloc(1, sizeof(struct data_store));
     if (!data_store) {
         perror("Failed to allocate data store memory");
         exit(EXIT_FAILURE);
     }
 
     // Fill values
-    data_store->words = readWords();
-    readPatterns(data_store);
+    data_store->words = readWords(words_file, &(data_store->words_size), required);
+    if (!data_store->words && !required) {
+        FILE *fp = fopen(words_file, "rb");
+        data_store->packed_only = !fp;
+        if (fp) {
+            fclose(fp);
+        }
+    }
+    readPatterns(data_store, index_file);
 
     return data_store;
 }
 
 /**
- * @brief Read the entire word list into memory and return the start location
+ * @brief Map the entire word list into memory and return the start location
+ * @param size set to the number of bytes in the word list
+ * @param required 1 to exit if the file does not exist, 0 to return NULL instead
  */
-char* readWords() {
-    // Open the file for reading
-    FILE *fp = fopen("data/words", "rb");
-    if (!fp) {
-        perror("Failed to open words file");
+char* readWords(char *file_name, size_t *size, char required) {
+    return mapFile(file_name, size, required);
+}
+
+/**
+ * @brief Map and parse the patternIndex file. Store it in the data_store object.
+ * Both the version 2 format and the original unversioned format can be read
+ */
+void readPatterns(struct data_store *data_store, char *file_name) {
+    data_store->index = mapFile(file_name, &(data_store->index_size), 1);
+
+    // Version 2 indices start with the magic bytes, the original format starts with
+    // the number of patterns
+    if (data_store->index_size >= INDEX_HEADER_SIZE && memcmp(data_store->index, INDEX_MAGIC, 4) == 0) {
+        readPatternsV2(data_store);
+    } else {
+        readPatternsV1(data_store);
+    }
+}
+
+/**
+ * @brief Parse an index in the original format: the number of patterns followed by
+ * variable length pattern records
+ */
+void readPatternsV1(struct data_store *data_store) {
+    char *record = data_store->index;
+    char *limit = record + data_store->index_size;
+
+    data_store->version = 1;
+    data_store->checksum = 0;
+
+    // Only version 2 stores can have packed words
+    if (data_store->packed_only) {
+        printf("Words file is missing\n");
         exit(EXIT_FAILURE);
     }
 
-    // Find end of file, hence find file length
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        perror("Failed to seek to end");
+    // Read the number of patterns, convert byte ordering
+    if (data_store->index_size < 4) {
+        printf("Pattern index is too short to hold the number of patterns\n");
         exit(EXIT_FAILURE);
     }
-    long end = ftell(fp);
-    if (end < 0) {
-        perror("Failed to get end length");
+    data_store->num_patterns = getU32(record);
+    record += 4;
+
+    // Allocate array to hold the patterns
+    data_store->patterns = calloc(sizeof(struct pattern), data_store->num_patterns);
+    if (!data_store->patterns && data_store->num_patterns) {
+        perror("Failed to allocate pattern structure memory");
         exit(EXIT_FAILURE);
     }
 
-    // Go back to start
-    rewind(fp);
+    // Parse each pattern into the allocated array, counting the words as we go
+    data_store->num_words = 0;
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+
+        record = readPattern(record, limit, p, data_store);
+
+        p->first = data_store->num_words;
+        data_store->num_words += (p->end - p->start) / p->len;
+    }
+}
 
-    // Allocate area in memory to hold words
-    char *words = malloc(end);
-    if (!words) {
-        perror("Failed to allocate words");
+/**
+ * @brief Parse a single pattern record at the location given into the pattern given.
+ * The pattern refers to the record and the word list in place, nothing is copied
+ * @param record start of the record in the mapped index
+ * @param limit location of the byte immediately following the index
+ * @param p pattern to load record into
+ * @param data_store store holding the full list of words
+ * @return char* start of the next record
+ */
+char* readPattern(char *record, char *limit, struct pattern* p, struct data_store *data_store) {
+    // Read the length of the pattern - the number of characters in the pattern
+    if (record >= limit) {
+        printf("Pattern index ends before pattern length\n");
         exit(EXIT_FAILURE);
     }
+    p->len = *record;
+    record++;
 
-    // Load words list into location
-    if (fread(words, 1, end, fp) != end) {
-        perror("Failed to read words");
+    // The pattern is left where it is in the index
+    if (p->len <= 0 || limit - record < p->len + 8) {
+        printf("Pattern index ends before pattern record\n");
         exit(EXIT_FAILURE);
     }
+    p->pattern = record;
+    record += p->len;
 
-    fclose(fp);
+    // Get start index and number of words
+    uint32_t start = getU32(record);
+    uint32_t num = getU32(record + 4);
+    record += 8;
 
-    return words;
+    checkPatternWords(p, start, num, data_store);
+
+    return record;
 }
 
 /**
- * @brief Read and parse the patternIndex file. Store it in the data_store object
+ * @brief Parse a version 2 index: a header, a fixed stride table of patterns and the
+ * pattern strings. The table is validated against the header and the words file
  */
-void readPatterns(struct data_store *data_store) {
-    // Open file for reading
-    FILE *fp = fopen("data/patternIndex", "rb");
-    if (!fp) {
-        perror("Failed to open pattern index");
+void readPatternsV2(struct data_store *data_store) {
+    char *header = data_store->index;
+
+    data_store->version = getU32(header + 4);
+    if (data_store->version != INDEX_VERSION) {
+        printf("Unsupported pattern index version %u\n", data_store->version);
         exit(EXIT_FAILURE);
     }
 
-    // Read the number of patterns, convert byte ordering
-    if (fread(&(data_store->num_patterns), 4, 1, fp) != 1) {
-        perror("Failed to read pattern number");
+    data_store->num_patterns = getU32(header + 8);
+    data_store->num_words = getU64(header + 16);
+    uint64_t words_size = getU64(header + 24);
+    data_store->checksum = getU64(header + 32);
+
+    // Without a words file the words' places are taken from the index, and are checked
+    // against the packed words once they are read
+    if (data_store->packed_only) {
+        data_store->words_size = words_size;
+        data_store->words = reserveMap(words_size);
+    }
+
+    // Catch an index being used with the wrong words file
+    if (words_size != data_store->words_size) {
+        printf("Words file is %zu bytes but the pattern index expects %" PRIu64 "\n",
+            data_store->words_size, words_size);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((data_store->index_size - INDEX_HEADER_SIZE) / INDEX_ENTRY_SIZE < data_store->num_patterns) {
+        printf("Pattern index ends before pattern table\n");
         exit(EXIT_FAILURE);
     }
-    data_store->num_patterns = ntohl(data_store->num_patterns);
 
     // Allocate array to hold the patterns
     data_store->patterns = calloc(sizeof(struct pattern), data_store->num_patterns);
-    if (!data_store->patterns) {
+    if (!data_store->patterns && data_store->num_patterns) {
         perror("Failed to allocate pattern structure memory");
         exit(EXIT_FAILURE);
     }
 
-    // Read each pattern into the allocated array
+    // Entries are a fixed size so each can be found directly
+    char *table = header + INDEX_HEADER_SIZE;
     for (uint32_t i = 0; i < data_store->num_patterns; i++) {
-        readPattern(fp, data_store->patterns + i, data_store->words);
+        readPatternEntry(table + (size_t) i * INDEX_ENTRY_SIZE, data_store->patterns + i, data_store);
     }
+}
 
-    fclose(fp);
+/**
+ * @brief Parse one entry of a version 2 pattern table into the pattern given.
+ * An entry holds the start of the words, the number of words, the number of words
+ * before this pattern, the pattern length and the location of the pattern string
+ */
+void readPatternEntry(char *entry, struct pattern* p, struct data_store *data_store) {
+    uint64_t start = getU64(entry);
+    uint64_t num = getU64(entry + 8);
+    p->first = getU64(entry + 16);
+    uint32_t len = getU32(entry + 24);
+    uint32_t pattern = getU32(entry + 28);
+
+    // The pattern string must be inside the index
+    if (len == 0 || len > INT32_MAX || pattern > data_store->index_size
+            || len > data_store->index_size - pattern) {
+        printf("Pattern table entry refers to a pattern outside of the index\n");
+        exit(EXIT_FAILURE);
+    }
+    p->len = len;
+    p->pattern = data_store->index + pattern;
+
+    checkPatternWords(p, start, num, data_store);
 }
 
 /**
- * @brief Read a single pattern record from the current place in the file to the location given
- * @param fp file to read record from
- * @param p pattern to load record into
- * @param words start location of the full list of words
+ * @brief Set the start and end of a pattern's words, making sure they are all within
+ * the words file
+ * @param p pattern with its length already set
+ * @param start index of the first byte of the first word
+ * @param num number of words in the pattern
  */
-void readPattern(FILE *fp, struct pattern* p, char *words) {
-    // Read the length of the pattern - the number of characters in the pattern
-    if (fread(&(p->len), 1, 1, fp) != 1) {
-        perror("Failed to read pattern length");
+void checkPatternWords(struct pattern* p, uint64_t start, uint64_t num, struct data_store *data_store) {
+    if (start > data_store->words_size || num > (data_store->words_size - start) / p->len) {
+        printf("Pattern refers to words outside of the word list\n");
+        exit(EXIT_FAILURE);
+    }
+    p->start = data_store->words + start;
+    p->end = p->start + (num * p->len);
+}
+
+/**
+ * @brief Build the hash table used to find a pattern's number from the pattern
+ */
+void indexPatterns(struct data_store *data_store) {
+    // Keep the table at most half full so probe sequences stay short
+    data_store->lookup_size = 16;
+    while (data_store->lookup_size < 2 * (uint64_t) data_store->num_patterns) {
+        data_store->lookup_size <<= 1;
+    }
+
+    data_store->lookup = calloc(sizeof(uint32_t), data_store->lookup_size);
+    if (!data_store->lookup) {
+        perror("Failed to allocate pattern lookup table");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t mask = data_store->lookup_size - 1;
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+
+        // Linear probing to the first empty slot
+        uint32_t slot = patternKey(p->len, p->pattern) & mask;
+        while (data_store->lookup[slot]) {
+            slot = (slot + 1) & mask;
+        }
+
+        data_store->lookup[slot] = i + 1;
+    }
+}
+
+/**
+ * @brief Find the number of a pattern in the store using the lookup table
+ * @return int number of the pattern, or -1 if the store does not have it
+ */
+int lookupPattern(struct data_store *data_store, int len, char *pattern) {
+    uint32_t mask = data_store->lookup_size - 1;
+    uint32_t slot = patternKey(len, pattern) & mask;
+
+    // Probe until the pattern or an empty slot is found
+    uint32_t entry;
+    while (entry = data_store->lookup[slot]) {
+        struct pattern* p = data_store->patterns + entry - 1;
+        if (p->len == len && memcmp(p->pattern, pattern, len) == 0) {
+            return entry - 1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Encode a pattern and its length as a single integer used as the hash table key.
+ * Patterns are already canonical (groups are numbered in order of first appearance) so
+ * equal patterns always have equal keys
+ */
+uint64_t patternKey(int len, char *pattern) {
+    uint64_t key = checksum(CHECKSUM_BASIS, (char *) &len, sizeof(len));
+    key = checksum(key, pattern, len);
+
+    // Mix the high bits down as only the low bits choose the slot
+    return key ^ (key >> 32);
+}
+
+/**
+ * @brief Map one of the optional files belonging to a version 2 store or delta segment.
+ * @param name name of the file in the store's directory, without the segment's number
+ * @param magic magic bytes the file must start with
+ * @param version version of the file's contents that can be read
+ * @param size set to the number of bytes in the file
+ * @return char* start of the mapping, or NULL if the file is missing or does not belong
+ * to this store
+ */
+char* readSection(struct data_store *data_store, char *name, char *magic, uint32_t version, size_t *size) {
+    *size = 0;
+    if (data_store->version < 2) {
+        return NULL;
+    }
+
+    char *file_name = storeFile(data_store->dir, name, data_store->segment);
+    char *map = mapFile(file_name, size, 0);
+    if (!map) {
+        free(file_name);
+        return NULL;
+    }
+
+    // Header fields other than the magic bytes are in this machine's byte order
+    uint32_t header[4];
+    uint64_t sum;
+    if (*size >= SECTION_HEADER_SIZE) {
+        memcpy(header, map, 16);
+        memcpy(&sum, map + 16, 8);
+    }
+
+    if (*size < SECTION_HEADER_SIZE || memcmp(map, magic, 4) != 0 || header[1] != version
+            || header[2] != SECTION_BYTE_ORDER || sum != data_store->checksum) {
+        printf("Ignoring '%s' as it was not made for this store\n", file_name);
+        free(file_name);
+        unmapFile(map, *size);
+        *size = 0;
+        return NULL;
+    }
+
+    free(file_name);
+    return map;
+}
+
+/**
+ * @brief Map the optional postings file and point each indexed pattern at its bitsets
+ */
+void readPostings(struct data_store *data_store) {
+    data_store->postings = readSection(data_store, "postings", POSTINGS_MAGIC, POSTINGS_VERSION,
+        &(data_store->postings_size));
+
+    if (data_store->postings && (data_store->postings_size - SECTION_HEADER_SIZE) / 8 < data_store->num_patterns) {
+        printf("Postings file ends before its table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t *offsets = NULL;
+    if (data_store->postings) {
+        offsets = (uint64_t *) (data_store->postings + SECTION_HEADER_SIZE);
+    }
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        uint64_t num = (p->end - p->start) / p->len;
+        p->blocks = (num + 63) / 64;
+        p->postings = NULL;
+
+        if (!offsets || offsets[i] == 0) {
+            continue;
+        }
+
+        // Bitsets must be aligned and inside the file
+        uint64_t size = (uint64_t) p->len * 26 * p->blocks * 8;
+        if (offsets[i] % 8 != 0 || offsets[i] > data_store->postings_size
+                || size > data_store->postings_size - offsets[i]) {
+            printf("Postings file refers to bitsets outside of the file\n");
+            exit(EXIT_FAILURE);
+        }
+        p->postings = (uint64_t *) (data_store->postings + offsets[i]);
+    }
+}
+
+/**
+ * @brief Map the optional file holding the letter set of every word
+ */
+void readMasks(struct data_store *data_store) {
+    data_store->masks_map = readSection(data_store, "masks", MASKS_MAGIC, MASKS_VERSION,
+        &(data_store->masks_size));
+    data_store->masks = NULL;
+
+    if (!data_store->masks_map) {
+        return;
+    }
+
+    if ((data_store->masks_size - SECTION_HEADER_SIZE) / 4 < data_store->num_words) {
+        printf("Letter set file ends before the last word\n");
+        exit(EXIT_FAILURE);
+    }
+    data_store->masks = (uint32_t *) (data_store->masks_map + SECTION_HEADER_SIZE);
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        data_store->patterns[i].masks = data_store->masks + data_store->patterns[i].first;
+    }
+}
+
+/**
+ * @brief Map the optional weights file and point each pattern at its words' weights
+ */
+void readWeights(struct data_store *data_store) {
+    data_store->weights_map = readSection(data_store, "weights", WEIGHTS_MAGIC, WEIGHTS_VERSION,
+        &(data_store->weights_size));
+    data_store->weights = NULL;
+
+    if (!data_store->weights_map) {
+        return;
+    }
+
+    if ((data_store->weights_size - SECTION_HEADER_SIZE) / 4 < data_store->num_words) {
+        printf("Weights file ends before the last word\n");
+        exit(EXIT_FAILURE);
+    }
+    data_store->weights = (uint32_t *) (data_store->weights_map + SECTION_HEADER_SIZE);
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        data_store->patterns[i].weights = data_store->weights + data_store->patterns[i].first;
+    }
+}
+
+/**
+ * @brief Map the optional packed words file and point each pattern at its words in it
+ */
+void readPacked(struct data_store *data_store) {
+    data_store->packed = readSection(data_store, "packed", PACKED_MAGIC, PACKED_VERSION,
+        &(data_store->packed_size));
+
+    if (data_store->packed && (data_store->packed_size - SECTION_HEADER_SIZE) / 8 < data_store->num_patterns) {
+        printf("Packed words file ends before its table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t *offsets = NULL;
+    if (data_store->packed) {
+        offsets = (uint64_t *) (data_store->packed + SECTION_HEADER_SIZE);
+    }
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        p->packed = NULL;
+
+        if (!offsets || offsets[i] == 0) {
+            continue;
+        }
+
+        // Units, and at least one after them, must be aligned and inside the file
+        uint64_t num = (p->end - p->start) / p->len;
+        uint64_t size = ((num * p->len * PACKED_BITS + 63) / 64 + 1) * 8;
+        if (offsets[i] % 8 != 0 || offsets[i] > data_store->packed_size
+                || size > data_store->packed_size - offsets[i]) {
+            printf("Packed words file refers to words outside of the file\n");
+            exit(EXIT_FAILURE);
+        }
+        p->packed = (uint64_t *) (data_store->packed + offsets[i]);
+    }
+}
+
+/**
+ * @brief Make sure a store without a words file has every word in its packed file
+ */
+void checkPacked(struct data_store *data_store) {
+    if (!data_store->packed_only) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        if (p->end > p->start && !p->packed) {
+            printf("Store has no words file and no packed words for all of its patterns\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Map the optional file of words stored by position and point each pattern at its
+ * columns in it
+ */
+void readColumns(struct data_store *data_store) {
+    data_store->columns = readSection(data_store, "columns", COLUMNS_MAGIC, COLUMNS_VERSION,
+        &(data_store->columns_size));
+
+    if (data_store->columns && (data_store->columns_size - SECTION_HEADER_SIZE) / 8 < data_store->num_patterns) {
+        printf("Columns file ends before its table\n");
         exit(EXIT_FAILURE);
     }
 
-    // Allocate memory to hold the pattern
-    p->pattern = calloc(1, p->len);
-    if (!p->pattern) {
-        perror("Failed to allocate pattern memory");
+    uint64_t *offsets = NULL;
+    if (data_store->columns) {
+        offsets = (uint64_t *) (data_store->columns + SECTION_HEADER_SIZE);
+    }
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        p->columns = NULL;
+
+        if (!offsets || offsets[i] == 0) {
+            continue;
+        }
+
+        // Columns, and the spare bytes after them, must be aligned and inside the file
+        uint64_t num = (p->end - p->start) / p->len;
+        uint64_t size = num * p->len + 64;
+        if (offsets[i] % BUCKET_ALIGN != 0 || offsets[i] > data_store->columns_size
+                || size > data_store->columns_size - offsets[i]) {
+            printf("Columns file refers to words outside of the file\n");
+            exit(EXIT_FAILURE);
+        }
+        p->columns = data_store->columns + offsets[i];
+    }
+}
+
+/**
+ * @brief Map the optional summary file and point each summarised pattern at its summary
+ */
+void readSummary(struct data_store *data_store) {
+    data_store->summary = readSection(data_store, "summary", SUMMARY_MAGIC, SUMMARY_VERSION,
+        &(data_store->summary_size));
+
+    if (data_store->summary && (data_store->summary_size - SECTION_HEADER_SIZE) / 8 < data_store->num_patterns) {
+        printf("Summary file ends before its table\n");
         exit(EXIT_FAILURE);
     }
 
-    // Read the pattern into the memory allocated
-    if (fread(p->pattern, 1, p->len, fp) != p->len) {
-        perror("Failed to read pattern");
+    uint64_t *offsets = NULL;
+    if (data_store->summary) {
+        offsets = (uint64_t *) (data_store->summary + SECTION_HEADER_SIZE);
+    }
+
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        p->summary = NULL;
+
+        if (!offsets || offsets[i] == 0) {
+            continue;
+        }
+
+        // Summaries must be aligned and inside the file
+        uint64_t size = (2 + (uint64_t) p->len * 26) * 8 + (uint64_t) p->len * 4;
+        if (offsets[i] % 8 != 0 || offsets[i] > data_store->summary_size
+                || size > data_store->summary_size - offsets[i]) {
+            printf("Summary file refers to a summary outside of the file\n");
+            exit(EXIT_FAILURE);
+        }
+        p->summary = (uint64_t *) (data_store->summary + offsets[i]);
+    }
+}
+
+/**
+ * @brief Layer every delta segment on top of the store.
+ * Segment k is held in words.k and patternIndex.k, numbered from one. The
+ * words of a segment are added after the words the store already has for each pattern,
+ * and patterns the store does not have are added to the end of its patterns. A segment's
+ * words have their own weights, in weights.k, when it was added to a weighted store
+ */
+void readDeltas(struct data_store *data_store) {
+    struct data_store **tail = &(data_store->delta);
+
+    for (int k = 1; ; k++) {
+        char *words_file = storeFile(data_store->dir, "words", k);
+        char *index_file = storeFile(data_store->dir, "patternIndex", k);
+
+        // Segments are numbered without gaps, so the first missing one is the end
+        FILE *fp = fopen(index_file, "rb");
+        if (!fp) {
+            free(words_file);
+            free(index_file);
+            break;
+        }
+        fclose(fp);
+
+        struct data_store *delta = readSegment(words_file, index_file, 1);
+        free(words_file);
+        free(index_file);
+        *tail = delta;
+        tail = &(delta->delta);
+
+        // The segment's weights are found beside its words, and must be pointed to before
+        // its patterns are copied
+        delta->segment = k;
+        delta->dir = malloc(strlen(data_store->dir) + 1);
+        if (!delta->dir) {
+            perror("Failed to allocate store directory");
+            exit(EXIT_FAILURE);
+        }
+        strcpy(delta->dir, data_store->dir);
+        readWeights(delta);
+
+        // Make room for every pattern of the segment being new
+        data_store->patterns = realloc(data_store->patterns,
+            ((size_t) data_store->num_patterns + delta->num_patterns) * sizeof(struct pattern));
+        if (!data_store->patterns) {
+            perror("Failed to allocate pattern structure memory");
+            exit(EXIT_FAILURE);
+        }
+
+        uint32_t known = data_store->num_patterns;
+        for (uint32_t i = 0; i < delta->num_patterns; i++) {
+            struct pattern* p = delta->patterns + i;
+
+            int id = lookupPattern(data_store, p->len, p->pattern);
+            if (id < 0 || (uint32_t) id >= known) {
+                // New pattern. Patterns within a segment are distinct so it cannot have
+                // been added already by this segment
+                data_store->patterns[data_store->num_patterns++] = *p;
+                continue;
+            }
+
+            // Add to the end of the pattern's segments
+            struct pattern* last = data_store->patterns + id;
+            while (last->next) {
+                last = last->next;
+            }
+            last->next = p;
+        }
+
+        data_store->num_words += delta->num_words;
+        data_store->deltas++;
+
+        // New patterns need adding to the lookup table
+        free(data_store->lookup);
+        indexPatterns(data_store);
+    }
+}
+
+/**
+ * @brief Only read the parts of the store's words and optional files that are used, and
+ * those given to loadPattern, rather than reading ahead of them. The index has already
+ * been read so is not affected
+ */
+void readLazily(struct data_store *data_store) {
+    for (struct data_store *ds = data_store; ds; ds = ds->delta) {
+        adviseMap(ds->words, ds->words, ds->words_size, 0);
+        adviseMap(ds->postings, ds->postings, ds->postings_size, 0);
+        adviseMap(ds->masks_map, ds->masks_map, ds->masks_size, 0);
+        adviseMap(ds->weights_map, ds->weights_map, ds->weights_size, 0);
+        adviseMap(ds->packed, ds->packed, ds->packed_size, 0);
+        adviseMap(ds->columns, ds->columns, ds->columns_size, 0);
+        adviseMap(ds->summary, ds->summary, ds->summary_size, 0);
+    }
+}
+
+/**
+ * @brief Start reading one pattern in the background, in the store and every delta
+ * segment. Only what a search with known letters reads through is read: the postings and
+ * letter sets when the pattern has postings, otherwise its columns, its packed words or
+ * its words, in that order. The words found through postings or columns are read as they
+ * are returned, so are left to be read then
+ * @param id number of the pattern, as found by lookupPattern
+ * @param summary 1 to read the pattern's summary as well, for a search with no known
+ * letters
+ */
+void loadPattern(struct data_store *data_store, int id, char summary) {
+    struct pattern *p = data_store->patterns + id;
+
+    if (summary && p->summary) {
+        adviseMap(data_store->summary, (char *) p->summary, (2 + (size_t) p->len * 26) * 8 + (size_t) p->len * 4, 1);
+    }
+
+    // Only the base store has the optional files, and patterns new to a segment are held
+    // in the base store's patterns, so the words may be in any segment's mapping
+    for (; p; p = p->next) {
+        uint64_t num = (p->end - p->start) / p->len;
+        if (!num) {
+            continue;
+        }
+
+        if (p->postings) {
+            adviseMap(data_store->postings, (char *) p->postings, (size_t) p->len * 26 * p->blocks * 8, 1);
+            if (p->masks) {
+                adviseMap(data_store->masks_map, (char *) p->masks, num * 4, 1);
+            }
+        } else if (p->columns) {
+            adviseMap(data_store->columns, p->columns, num * p->len, 1);
+        } else if (p->packed) {
+            adviseMap(data_store->packed, (char *) p->packed, ((num * p->len * PACKED_BITS + 63) / 64 + 1) * 8, 1);
+        } else {
+            struct data_store *ds = data_store;
+            while (p->start < ds->words || p->start >= ds->words + ds->words_size) {
+                ds = ds->delta;
+            }
+            adviseMap(ds->words, p->start, p->end - p->start, 1);
+        }
+    }
+}
+
+/**
+ * @brief Tell the system how part of a mapping is going to be used
+ * @param map start of the mapping made by mapFile
+ * @param start first byte of the part, at any alignment
+ * @param size number of bytes in the part
+ * @param needed 1 if the part will be needed soon so should be read now, 0 if the part
+ * is used randomly so should not be read ahead
+ */
+void adviseMap(char *map, char *start, size_t size, char needed) {
+    if (!map || size == 0) {
+        return;
+    }
+
+    #ifdef _WIN32
+    // Pages are read as they are first touched
+    #else
+    // Advice is given for whole pages. Any page size divides ADVICE_ALIGN, and the mapping
+    // itself starts on a page
+    char *first = (char *) ((uintptr_t) start & ~(uintptr_t) (ADVICE_ALIGN - 1));
+    if (first < map) {
+        first = map;
+    }
+
+    madvise(first, size + (start - first), needed ? MADV_WILLNEED : MADV_RANDOM);
+    #endif
+}
+
+/**
+ * @brief Read an unsigned 64-bit integer stored in network order at any alignment
+ */
+uint64_t getU64(char *b) {
+    return ((uint64_t) getU32(b) << 32) | getU32(b + 4);
+}
+
+/**
+ * @brief Read an unsigned 32-bit integer stored in network order at any alignment
+ */
+uint32_t getU32(char *b) {
+    uint32_t n;
+    memcpy(&n, b, 4);
+    return ntohl(n);
+}
+
+/**
+ * @brief Continue a 64-bit FNV-1a checksum over more data
+ * @param hash checksum so far, starting with CHECKSUM_BASIS
+ * @return uint64_t checksum including data
+ */
+uint64_t checksum(uint64_t hash, char *data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Calculate the checksum of a version 2 store: the words file followed by the
+ * index after its header. This reads every page of both files so is not done on load.
+ * A store without a words file has the words file its packed words would make summed
+ * instead: the words unpacked, with zeros between the patterns
+ */
+uint64_t storeChecksum(struct data_store *data_store) {
+    if (!data_store->packed_only) {
+        uint64_t hash = checksum(CHECKSUM_BASIS, data_store->words, data_store->words_size);
+        return checksum(hash, data_store->index + INDEX_HEADER_SIZE, data_store->index_size - INDEX_HEADER_SIZE);
+    }
+
+    uint64_t hash = CHECKSUM_BASIS;
+    char *at = data_store->words;
+    char *end = data_store->words + data_store->words_size;
+    char zeros[BUCKET_ALIGN] = {0};
+
+    // Patterns are in the order of their words. Those delta segments add come after the
+    // base store's and have words elsewhere
+    for (uint32_t i = 0; i < data_store->num_patterns; i++) {
+        struct pattern* p = data_store->patterns + i;
+        if (p->start < at || p->start >= end) {
+            continue;
+        }
+
+        for (; at < p->start; at += BUCKET_ALIGN) {
+            hash = checksum(hash, zeros, p->start - at < BUCKET_ALIGN ? p->start - at : BUCKET_ALIGN);
+        }
+        at = p->start;
+
+        char word[p->len];
+        for (uint64_t w = 0; at < p->end; w++, at += p->len) {
+            hash = checksum(hash, patternWord(p, w, word), p->len);
+        }
+    }
+    for (; at < end; at += BUCKET_ALIGN) {
+        hash = checksum(hash, zeros, end - at < BUCKET_ALIGN ? end - at : BUCKET_ALIGN);
+    }
+
+    return checksum(hash, data_store->index + INDEX_HEADER_SIZE, data_store->index_size - INDEX_HEADER_SIZE);
+}
+
+/**
+ * @brief Get the letters of one of a pattern's words, unpacked from the packed words when
+ * the pattern has them, otherwise from the words file
+ * @param w number of the word in the pattern's segment
+ * @param word space for the pattern's length of letters, used when the word is unpacked
+ * @return char* the letters, in word or in the words file
+ */
+char* patternWord(struct pattern* p, uint64_t w, char *word) {
+    if (!p->packed) {
+        return p->start + w * p->len;
+    }
+
+    uint64_t bit = w * p->len * PACKED_BITS;
+    for (int i = 0; i < p->len; i++, bit += PACKED_BITS) {
+        uint64_t bits = p->packed[bit / 64] >> (bit % 64);
+        if (bit % 64 > 64 - PACKED_BITS) {
+            bits |= p->packed[bit / 64 + 1] << (64 - bit % 64);
+        }
+        word[i] = 'a' + (bits & 31);
+    }
+
+    return word;
+}
+
+/**
+ * @brief Allocate the path of one of a store's files
+ * @param dir directory holding the store
+ * @param name name of the file
+ * @param k number of the delta segment the file belongs to, 0 for the base store
+ * @return char* the path, "dir/name" or "dir/name.k"
+ */
+char* storeFile(char *dir, char *name, int k) {
+    char *path = malloc(strlen(dir) + strlen(name) + 14);
+    if (!path) {
+        perror("Failed to allocate file name");
+        exit(EXIT_FAILURE);
+    }
+
+    if (k) {
+        sprintf(path, "%s/%s.%d", dir, name, k);
+    } else {
+        sprintf(path, "%s/%s", dir, name);
+    }
+
+    return path;
+}
+
+/**
+ * @brief Map a whole file into memory, read-only
+ * @param file_name path of the file to map
+ * @param size set to the number of bytes in the file
+ * @param required 1 to exit if the file does not exist, 0 to return NULL instead
+ * @return char* start of the mapping, or NULL if the file is empty or missing
+ */
+char* mapFile(char *file_name, size_t *size, char required) {
+    char *map = NULL;
+    *size = 0;
+
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        if (!required && GetLastError() == ERROR_FILE_NOT_FOUND) {
+            return NULL;
+        }
+
+        printf("Failed to open '%s'\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length)) {
+        printf("Failed to get length of '%s'\n", file_name);
         exit(EXIT_FAILURE);
     }
+    *size = length.QuadPart;
+
+    if (*size > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            printf("Failed to create mapping of '%s'\n", file_name);
+            exit(EXIT_FAILURE);
+        }
+
+        map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!map) {
+            printf("Failed to map '%s'\n", file_name);
+            exit(EXIT_FAILURE);
+        }
+
+        // The view keeps the mapping alive
+        CloseHandle(mapping);
+    }
+
+    CloseHandle(file);
+    #else
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp) {
+        if (!required && errno == ENOENT) {
+            return NULL;
+        }
 
-    // Get start index
-    uint32_t start;
-    if (fread(&start, 4, 1, fp) != 1) {
-        perror("Failed to read start");
+        perror("Failed to open data file");
         exit(EXIT_FAILURE);
     }
-    p->start = words + ntohl(start);
 
-    // Get end
-    uint32_t num;
-    if (fread(&num, 4, 1, fp) != 1) {
-        perror("Failed to read num");
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        perror("Failed to get data file length");
         exit(EXIT_FAILURE);
     }
-    p->end = p->start + (ntohl(num) * p->len);
+    *size = st.st_size;
+
+    // Zero length mappings are not allowed
+    if (*size > 0) {
+        map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+        if (map == MAP_FAILED) {
+            perror("Failed to map data file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The mapping stays valid after the file is closed
+    fclose(fp);
+    #endif
+
+    return map;
+}
+
+/**
+ * @brief Release a mapping made by mapFile
+ */
+void unmapFile(char *map, size_t size) {
+    if (!map) {
+        return;
+    }
+
+    #ifdef _WIN32
+    UnmapViewOfFile(map);
+    #else
+    munmap(map, size);
+    #endif
+}
+
+/**
+ * @brief Reserve a range of addresses without anything behind it, which must not be read
+ * @param size number of bytes in the range
+ * @return char* start of the range, or NULL if size is zero
+ */
+char* reserveMap(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    #ifdef _WIN32
+    char *map = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (!map) {
+        printf("Failed to reserve %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+    #else
+    char *map = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to reserve addresses");
+        exit(EXIT_FAILURE);
+    }
+    #endif
+
+    return map;
+}
+
+/**
+ * @brief Release a range reserved by reserveMap
+ */
+void releaseMap(char *map, size_t size) {
+    if (!map) {
+        return;
+    }
+
+    #ifdef _WIN32
+    VirtualFree(map, 0, MEM_RELEASE);
+    #else
+    munmap(map, size);
+    #endif
 }
 
 /**
  * @brief Function for freeing a datastore object and all internal structures
  */
 void freeDataStore(struct data_store* ds) {
-    free(ds->words);
-
-    for (uint32_t i = 0; i < ds->num_patterns; i++) {
-        struct pattern* p = ds->patterns + i;
-        free(p->pattern);
+    if (ds->packed_only) {
+        releaseMap(ds->words, ds->words_size);
+    } else {
+        unmapFile(ds->words, ds->words_size);
     }
+    unmapFile(ds->index, ds->index_size);
+    unmapFile(ds->postings, ds->postings_size);
+    unmapFile(ds->masks_map, ds->masks_size);
+    unmapFile(ds->weights_map, ds->weights_size);
+    unmapFile(ds->packed, ds->packed_size);
+    unmapFile(ds->columns, ds->columns_size);
+    unmapFile(ds->summary, ds->summary_size);
 
     free(ds->patterns);
+    free(ds->lookup);
+    free(ds->dir);
+
+    if (ds->delta) {
+        freeDataStore(ds->delta);
+    }
 
     free(ds);
 }
@@ -1,27 +1,215 @@
-
 #ifndef DATA_STORE_H_
 #define DATA_STORE_H_
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 
+// Version 2 pattern index layout. The file starts with a header holding the magic
+// bytes, version, number of patterns, a reserved word, number of words, size of the
+// words file and a checksum. Following it is a table of fixed size entries, one per
+// pattern, and then the pattern strings. All integers are stored in network order.
+#define INDEX_MAGIC "CWPI"
+#define INDEX_VERSION 2
+#define INDEX_HEADER_SIZE 40
+#define INDEX_ENTRY_SIZE 32
+
+// Every pattern's words start on a boundary of this many bytes in a version 2 words file
+#define BUCKET_ALIGN 64
+
+// Optional files holding extra data for a version 2 store start with a 24-byte header:
+// the file's magic bytes, its version, a byte order marker, a reserved word and the
+// checksum of the index it was made for. Unlike the index, the contents are stored in
+// the byte order of the machine that made them so they can be used in place. A file is
+// ignored if its marker shows a different byte order or its checksum does not match
+#define SECTION_HEADER_SIZE 24
+#define SECTION_BYTE_ORDER 0x01020304
+
+// Letter posting bitsets, one per position and letter for each large enough pattern.
+// After the header is the offset of each pattern's bitsets (zero for none), 64 bits each
+#define POSTINGS_MAGIC "CWPB"
+#define POSTINGS_VERSION 1
+#define POSTINGS_MIN_WORDS 64
+
+// Letter set of every word: 32 bits each, in the same order as the words, with bit l set
+// when the word contains letter l. Directly after the header
+#define MASKS_MAGIC "CWLM"
+#define MASKS_VERSION 1
+
+// Weight of every word, such as how often it is used: 32 bits each, in the same order
+// as the words. Directly after the header
+#define WEIGHTS_MAGIC "CWWT"
+#define WEIGHTS_VERSION 1
+
+// Words packed into 5 bits per letter, letter l stored as the value l, written by makeData
+// in place of the words file when asked for. Each pattern's
+// words follow one another as a stream of bits held in 64-bit units, with bit j of the
+// stream being bit j % 64 of unit j / 64, so word w of a pattern of length n starts at
+// bit w * n * 5. After the header is the offset of each pattern's units (zero for none),
+// 64 bits each. Every pattern starts on a new unit, and the file ends with a spare unit so
+// any 64 bits of the last pattern can be read from two units
+#define PACKED_MAGIC "CWPK"
+#define PACKED_VERSION 1
+#define PACKED_BITS 5
+#define PACKED_LETTERS 12 // letters in each 64-bit chunk compared at once
+
+// Parts of a mapping are advised on boundaries of this many bytes, a multiple of the
+// size of a page on any system
+#define ADVICE_ALIGN 65536
+
+// Words stored by position: for each pattern, the first letter of every word, then the
+// second letter of every word and so on. After the header is the offset of each
+// pattern's columns (zero for none), 64 bits each. Each pattern starts on a boundary of
+// BUCKET_ALIGN bytes, column i of a pattern with n words starts n * i bytes after it, and
+// the file ends with 64 spare bytes so 64 letters can be read from any word of any column
+#define COLUMNS_MAGIC "CWCM"
+#define COLUMNS_VERSION 1
+
+// Letters in each position of every word of each large enough pattern, with the weights
+// behind them. After the header is the offset of each pattern's summary (zero for none),
+// 64 bits each. A summary of a pattern of length n holds the total weight of its words,
+// the weight of the heaviest, then the total weight of the words with letter l at
+// position i at unit 2 + i * 26 + l, all 64 bits each, followed by n 32-bit sets of the
+// letters found at each position
+#define SUMMARY_MAGIC "CWSM"
+#define SUMMARY_VERSION 1
+#define SUMMARY_MIN_WORDS 64
+
+// Starting value of the checksum (64-bit FNV-1a) over the words file and index body
+#define CHECKSUM_BASIS 0xcbf29ce484222325ULL
+
 struct data_store {
+    char *dir; // directory the store was read from
+    uint32_t version; // 1 for the original unversioned format
     uint32_t num_patterns;
+    uint64_t num_words;
+    uint64_t checksum; // stored checksum, version 2 only
     struct pattern* patterns;
     char *words;
+    size_t words_size;
+
+    // Set when the store has no words file, so its words are read from the packed file.
+    // words is then a range of addresses reserved for the words file, never read, so
+    // patterns still give where their words are and how many there are
+    char packed_only;
+
+    // Read-only mapping of the pattern index. Patterns point into this and into words,
+    // so freeing the store is only a matter of unmapping the two files
+    char *index;
+    size_t index_size;
+
+    // Open addressed hash table from pattern key to pattern, built on load. Each slot
+    // holds the number of the pattern plus one, or zero when empty. The size is a
+    // power of two
+    uint32_t *lookup;
+    uint32_t lookup_size;
+
+    // Mapping of the optional postings file, NULL when not in use
+    char *postings;
+    size_t postings_size;
+
+    // Mapping of the optional letter set file and the sets in it, NULL when not in use.
+    // The set of word w of a pattern is masks[first + w]
+    char *masks_map;
+    size_t masks_size;
+    uint32_t *masks;
+
+    // Mapping of the optional weights file and the weights in it, NULL when not in use.
+    // The weight of word w of a pattern is weights[first + w]
+    char *weights_map;
+    size_t weights_size;
+    uint32_t *weights;
+
+    // Mapping of the optional packed words file, NULL when not in use
+    char *packed;
+    size_t packed_size;
+
+    // Mapping of the optional file of words stored by position, NULL when not in use
+    char *columns;
+    size_t columns_size;
+
+    // Mapping of the optional summary file, NULL when not in use
+    char *summary;
+    size_t summary_size;
+
+    // Delta segments layered on this store, each holding its own words and index. The
+    // store's patterns link to the words each segment adds to them
+    struct data_store *delta;
+    int deltas;
+
+    // Number of this segment: 0 for the base store, k for delta segment k, whose optional
+    // files are named with .k added like its words and index
+    int segment;
 };
 
 struct pattern {
-    char len;
+    int len;
     char *pattern;
     char *start;
     char *end; // location of byte immediately following the last entry
+    uint64_t first; // number of words in the store before this pattern's first word
+
+    // Bitsets over the words for each position and letter, NULL when not indexed.
+    // The bitset for letter l at position i is at postings + (i * 26 + l) * blocks
+    uint64_t *postings;
+    uint64_t blocks; // number of 64-bit blocks in each bitset
+
+    // Letter sets of the words, NULL when not stored
+    uint32_t *masks;
+
+    // Weights of the words, NULL when not stored
+    uint32_t *weights;
+
+    // Words packed into 5 bits per letter, NULL when not stored
+    uint64_t *packed;
+
+    // Words stored by position, NULL when not stored. Letter i of word w of n words is
+    // at columns[i * n + w]
+    char *columns;
+
+    // Summary of the letters at each position of the words in this segment, NULL when
+    // not stored
+    uint64_t *summary;
+
+    // More words with this pattern in the next delta segment that has any, NULL for none
+    struct pattern *next;
 };
 
 struct data_store* read();
-char* readWords();
-void readPatterns(struct data_store *data_store);
-void readPattern(FILE *fp, struct pattern* p, char *words);
+struct data_store* readStore(char *dir);
+struct data_store* readSegment(char *words_file, char *index_file, char required);
+char* readWords(char *file_name, size_t *size, char required);
+void readPatterns(struct data_store *data_store, char *file_name);
+void readPatternsV1(struct data_store *data_store);
+char* readPattern(char *record, char *limit, struct pattern* p, struct data_store *data_store);
+void readPatternsV2(struct data_store *data_store);
+void readPatternEntry(char *entry, struct pattern* p, struct data_store *data_store);
+void checkPatternWords(struct pattern* p, uint64_t start, uint64_t num, struct data_store *data_store);
+void indexPatterns(struct data_store *data_store);
+char* readSection(struct data_store *data_store, char *name, char *magic, uint32_t version, size_t *size);
+void readPostings(struct data_store *data_store);
+void readMasks(struct data_store *data_store);
+void readWeights(struct data_store *data_store);
+void readPacked(struct data_store *data_store);
+void readColumns(struct data_store *data_store);
+void readSummary(struct data_store *data_store);
+void checkPacked(struct data_store *data_store);
+void readDeltas(struct data_store *data_store);
+void readLazily(struct data_store *data_store);
+void loadPattern(struct data_store *data_store, int id, char summary);
+void adviseMap(char *map, char *start, size_t size, char needed);
+int lookupPattern(struct data_store *data_store, int len, char *pattern);
+uint64_t patternKey(int len, char *pattern);
+uint64_t getU64(char *b);
+uint32_t getU32(char *b);
+uint64_t checksum(uint64_t hash, char *data, size_t n);
+uint64_t storeChecksum(struct data_store *data_store);
+char* patternWord(struct pattern* p, uint64_t w, char *word);
+char* storeFile(char *dir, char *name, int k);
+char* mapFile(char *file_name, size_t *size, char required);
+void unmapFile(char *map, size_t size);
+char* reserveMap(size_t size);
+void releaseMap(char *map, size_t size);
 void freeDataStore(struct data_store* ds);
 
 #endif
@@ -1,113 +1,352 @@
 /**
  * This script will read in a dictionray of words ('\n\r' separated) 
- * from the directory "data" and produce a compatible data store in
- * the same directory.
+ * and produce a compatible data store in the directory "data", or the
+ * directory given with -o: the files words, patternIndex, postings, masks and summary.
+ * Each word may be followed on its line by spaces or tabs and its frequency, in
+ * which case the frequencies are stored as the words' weights in the file weights.
+ * With --columns the words are also stored by position in the file columns, which is
+ * searched in place of postings so the postings file is not written. With --packed the
+ * words are stored 5 bits per letter in the file packed in place of the file words.
  * 
  * Compiles with link: '-l ws2_32'
  * 
- * Usage: ./makeData <file_name> [test]
- * where file_name is a path to the input file
- * and test is inlcuded to output to stdout rather than create new files
+ * Usage: ./makeData <file_name> [test] [-j threads] [-o dir] [--delta] [--columns] [--packed]
+ *        ./makeData --compact [-o dir] [--columns] [--packed]
+ * where file_name is a path to the input file,
+ * test is inlcuded to output to stdout rather than create new files,
+ * threads is the number of threads to read the input with (default 1)
+ * and --delta adds the words not already in the store as a new delta segment, with
+ * their weights in weights.k when the store has weights.
+ * --compact folds the store's delta segments into a new base store.
+ *
+ * The input is split into one chunk per thread at line boundaries. Each thread
+ * sorts its chunk's words into its own table of patterns, then the tables are
+ * merged in the order of the chunks. The output is the same for any number of
+ * threads.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
+#include <stdatomic.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
+#include <windows.h>
 #else
 #include <arpa/inet.h>
+#include <pthread.h>
 #endif
 
+#include "dataStore.h"
 #include "makeData.h"
 
-// Temporary linked list for the patterns (and subsequently words)
-struct pattern_list_node* list = NULL;
+// All the patterns and words of the input, merged from the chunks
+struct table patterns = {0};
 
-// Current length of that linked list
-uint32_t num_patterns = 0;
+// Directory the store is written to
+char *directory = "data";
 
-// Buffer to hold a line being read from the file
-char buffer[100];
-char pattern_buffer[100];
+// Set to 1 to write the columns file
+char columns = 0;
+
+// Set to 1 to write the packed words file in place of the words file
+char pack = 0;
+
+// Memory currently allocated for the tables and words, and the most there has been
+atomic_size_t memory_used = 0;
+atomic_size_t memory_peak = 0;
 
 int main(int argc, char** argv) {
-    if (argc != 2 && argc != 3) {
-        printf("Usage: $ %s <file_name> [test]\n", argv[0]);
+    char *file_name = NULL;
+    char test = 0;
+    char delta = 0;
+    char compact = 0;
+    long threads = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "test") == 0) {
+            test = 1;
+        } else if (strcmp(argv[i], "--delta") == 0) {
+            delta = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = 1;
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            columns = 1;
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            pack = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            directory = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char *end;
+            threads = strtol(argv[++i], &end, 10);
+            if (*end || threads < 1 || threads > MAX_THREADS) {
+                printf("Thread count must be between 1 and %d, not '%s'\n", MAX_THREADS, argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!file_name) {
+            file_name = argv[i];
+        } else {
+            printf("Unrecognised argument '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (compact ? (file_name || test || delta) : !file_name) {
+        printf("Usage: $ %s <file_name> [test] [-j threads] [-o dir] [--delta] [--columns] [--packed]\n", argv[0]);
+        printf("    or $ %s --compact [-o dir] [--columns] [--packed]\n", argv[0]);
         printf("Where file_name is the name of the dictionary file\n");
         printf("Include test flag to output to stdout a verbose representation\n");
+        printf("Use -j to read the dictionary with more than one thread\n");
+        printf("Use -o to write the store to a directory other than 'data'\n");
+        printf("Use --delta to add the dictionary's new words to the store as a delta segment\n");
+        printf("Use --compact to fold the delta segments into the rest of the store\n");
+        printf("Use --columns to store the words by position instead of writing postings\n");
+        printf("Use --packed to store the words in 5 bits per letter instead of one byte\n");
         exit(EXIT_FAILURE);
     }
 
-    if (argc == 3 && strcmp(argv[2], "test") != 0) {
-        printf("Unrecognised second argument '%s'\n", argv[2]);
-        exit(EXIT_FAILURE);
-    }
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
 
-    // Load the word list in
-    input(argv[1]);
+    char *words_file = storeFile(directory, "words", 0);
+    char *index_file = storeFile(directory, "patternIndex", 0);
 
-    // Output the processed patterns to stdout or the files, depending on arguments given
-    if (argc == 3) {
-        outputStd();
+    if (compact) {
+        // Read every word of the store and write them back as a single store
+        int deltas = loadStore();
+        outputFile(words_file, index_file, 0, 1);
+        removeDeltas(deltas);
     } else {
-        outputFile();
+        // Load the word list in
+        input(file_name, threads);
+
+        // Output the processed patterns to stdout or the files, depending on arguments given
+        if (test) {
+            outputStd();
+        } else if (delta) {
+            outputDelta();
+        } else {
+            outputFile(words_file, index_file, 0, 1);
+        }
     }
 
+    free(words_file);
+    free(index_file);
+
+    report(&start, threads);
+
+    free_table(&patterns);
+
     return 0;
 }
 
 /**
- * @brief Load the words list from the file given
+ * @brief Load the words list from the file given, using the number of threads given
  */
-void input(char *file_name) {
-    FILE* fp = fopen(file_name, "r");
-    if (!fp) {
-        perror("Cannot open file");
-        exit(EXIT_FAILURE);
+void input(char *file_name, int threads) {
+    size_t size;
+    char *text = mapFile(file_name, &size, 1);
+
+    // Split into chunks of about equal size, each ending just after a line terminator
+    struct chunk chunks[MAX_THREADS] = {0};
+    char *at = text;
+    char *end = text + size;
+    for (int i = 0; i < threads; i++) {
+        chunks[i].start = at;
+
+        if (i == threads - 1) {
+            at = end;
+        } else {
+            char *target = text + (size / threads) * (i + 1);
+            if (target < at) {
+                target = at;
+            }
+
+            char *nl = target < end ? memchr(target, '\n', end - target) : NULL;
+            at = nl ? nl + 1 : end;
+        }
+
+        chunks[i].end = at;
     }
 
-    // Get the next line, form a pattern and add it to the list
-    while (fgets(buffer, 100, fp)) {
-        get_pattern();
-        add_pattern();
+    // Read each chunk into its own table. The first runs on this thread
+    #ifdef _WIN32
+    HANDLE handles[MAX_THREADS];
+    for (int i = 1; i < threads; i++) {
+        handles[i] = CreateThread(NULL, 0, run_chunk, chunks + i, 0, NULL);
+        if (!handles[i]) {
+            printf("Failed to start thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    input_chunk(chunks);
+    for (int i = 1; i < threads; i++) {
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+    }
+    #else
+    pthread_t handles[MAX_THREADS];
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(handles + i, NULL, run_chunk, chunks + i) != 0) {
+            perror("Failed to start thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    input_chunk(chunks);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    #endif
+
+    // Merge in input order so patterns and words are in the order they were first seen.
+    // The first chunk's table is already in that order so is used as it is
+    patterns = chunks[0].table;
+    for (int i = 1; i < threads; i++) {
+        merge(&patterns, &(chunks[i].table));
+        free_table(&(chunks[i].table));
     }
 
-    fclose(fp);
+    unmapFile(text, size);
 }
 
 /**
- * @brief Get the pattern for the word currently held in buffer
+ * @brief Thread entry point for reading a chunk
  */
-void get_pattern() {
-    // Cut off at first line terminator
-    char *b = buffer;
-    while (*b) {
-        // Once reached line terminator, cut string
-        if (*b == '\n' || *b == '\r') {
-            *b = 0;
-            break;
-        }
-
-        // Check all other characters are alphabetic
-        if (*b < 'a' || *b > 'z') {
-            printf("Error in line '%s': non-alphabetic character '%c' (%d) encountered\n", buffer, *b, *b);
+#ifdef _WIN32
+DWORD WINAPI run_chunk(LPVOID chunk) {
+    input_chunk(chunk);
+    return 0;
+}
+#else
+void* run_chunk(void *chunk) {
+    input_chunk(chunk);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Form a pattern for each line of a chunk and add it with its word to the chunk's table
+ */
+void input_chunk(struct chunk* c) {
+    // Buffer for the pattern of the current line, grown for longer lines
+    char *pattern = NULL;
+    size_t pattern_size = 0;
+
+    char *line = c->start;
+    while (line < c->end) {
+        // Find the end of the line and the next line
+        char *nl = memchr(line, '\n', c->end - line);
+        char *next = nl ? nl + 1 : c->end;
+        char *stop = nl ? nl : c->end;
+
+        // Cut off at first line terminator
+        char *cr = memchr(line, '\r', stop - line);
+        if (cr) {
+            stop = cr;
+        }
+
+        // The word may be followed by spacing and its frequency
+        char *word_end = line;
+        while (word_end < stop && *word_end != ' ' && *word_end != '\t') {
+            word_end++;
+        }
+
+        char *frequency = word_end;
+        while (frequency < stop && (*frequency == ' ' || *frequency == '\t')) {
+            frequency++;
+        }
+
+        uint32_t weight = 1;
+        if (frequency < stop) {
+            weight = get_weight(frequency, stop, line);
+            c->table.weighted = 1;
+        }
+
+        size_t n = word_end - line;
+        if (n > INT32_MAX) {
+            printf("Line of %zu characters is too long\n", n);
             exit(EXIT_FAILURE);
         }
 
-        b++;
+        // Blank lines hold no word
+        if (n > 0) {
+            if (n > pattern_size) {
+                pattern = resize(pattern, pattern_size, n);
+                pattern_size = n;
+            }
+
+            get_pattern(line, n, pattern);
+            add_pattern(&(c->table), line, n, pattern, weight);
+        }
+
+        line = next;
+    }
+
+    resize(pattern, pattern_size, 0);
+}
+
+/**
+ * @brief Read the frequency following a word on a line, used as the word's weight.
+ * Frequencies too large to store are stored as the largest weight, and a frequency of
+ * zero is stored as one so every word has some weight
+ * @param at start of the frequency
+ * @param stop end of the line
+ * @param line start of the line, for error messages
+ * @return uint32_t the weight
+ */
+uint32_t get_weight(char *at, char *stop, char *line) {
+    uint64_t weight = 0;
+    char *digits = at;
+    while (at < stop && *at >= '0' && *at <= '9') {
+        if (weight < UINT32_MAX) {
+            weight = weight * 10 + (*at - '0');
+        }
+        at++;
+    }
+    char *digits_end = at;
+
+    while (at < stop && (*at == ' ' || *at == '\t')) {
+        at++;
+    }
+
+    if (digits == digits_end || at != stop) {
+        printf("Error in line '%.*s': frequency is not a whole number\n", (int) (stop - line), line);
+        exit(EXIT_FAILURE);
+    }
+
+    if (weight > UINT32_MAX) {
+        weight = UINT32_MAX;
+    }
+
+    return weight ? weight : 1;
+}
+
+/**
+ * @brief Get the pattern for a word
+ * @param word letters of the word, not terminated
+ * @param n number of letters
+ * @param pattern set to the pattern, n characters
+ */
+void get_pattern(char *word, int n, char *pattern) {
+    // Check all characters are alphabetic
+    for (int i = 0; i < n; i++) {
+        if (word[i] < 'a' || word[i] > 'z') {
+            printf("Error in line '%.*s': non-alphabetic character '%c' (%d) encountered\n", n, word, word[i], word[i]);
+            exit(EXIT_FAILURE);
+        }
     }
 
     // Count frequency of letters in word
-    char alpha[26] = {0};
-    for (int i = 0; buffer[i]; i++) {
-        alpha[buffer[i] - 'a']++;
+    int alpha[26] = {0};
+    for (int i = 0; i < n; i++) {
+        alpha[word[i] - 'a']++;
     }
 
     #if DEBUG
-        printf("%s\n", buffer);
+        printf("%.*s\n", n, word);
         for (int i = 0; i < 26; i++) {
             printf("%d", alpha[i]);
         }
@@ -123,294 +362,1042 @@ void get_pattern() {
     char groups[26] = {0};
 
     // Assign letters to groups
-    for (int i = 0; buffer[i]; i++) {
-        int n = buffer[i] - 'a';
+    for (int i = 0; i < n; i++) {
+        int l = word[i] - 'a';
 
-        #if DEBUG
-            printf("%c %d ", buffer[i], n);
-        #endif
-
-        if (alpha[n] == 1) {
+        if (alpha[l] == 1) {
             // Only one - default group
-            pattern_buffer[i] = 0;
-
-            #if DEBUG
-                printf("default\n");
-            #endif
+            pattern[i] = 0;
         } else {
             // More than one - assign group
 
             // New group
-            if (groups[n] == 0) {
-                groups[n] = group++;
-
-                #if DEBUG
-                    printf("new group ");
-                #endif
+            if (groups[l] == 0) {
+                groups[l] = group++;
             }
 
             // Assign
-            pattern_buffer[i] = groups[n];
-
-            #if DEBUG
-                printf("group %d\n", groups[n]);
-            #endif
+            pattern[i] = groups[l];
         }
     }
 }
 
 /**
- * @brief Add the pattern currently held in pattern_buffer and the associated word in buffer
- * to the list of patterns and words
+ * @brief Add a word and its pattern to a table of patterns and words
  */
-void add_pattern() {
-    // Get the length of both pattern and word
-    int n = strlen(buffer);
-
+void add_pattern(struct table* t, char *word, int n, char *pattern, uint32_t weight) {
     #if DEBUG
         for (int i = 0; i < n; i++) {
-            printf("%d ", pattern_buffer[i]);
+            printf("%d ", pattern[i]);
         }
         printf("\n");
     #endif
 
-    // Search current pattern list to see if this pattern is already in use
-    struct pattern_list_node* head = list;
-    while (head) {
-        #if DEBUG
-            for (int i = 0; i < n; i++) {
-                printf("%d ", head->pattern[i]);
-            }
-            printf("\n");
-        #endif
+    add_word_to_bucket(find_bucket(t, n, pattern), word, &weight, n);
+}
 
-        // If patterns match, add to list and return
-        if (head->len == n && memcmp(pattern_buffer, head->pattern, n) == 0) {
-            // Found location
-            add_word_to_pattern(head, n);
+/**
+ * @brief Find the bucket for a pattern in a table, making a new one if there is none
+ */
+struct bucket* find_bucket(struct table* t, int n, char *pattern) {
+    // Keep the table at most half full so probe sequences stay short
+    if (2 * ((uint64_t) t->num_patterns + 1) > t->slots_size) {
+        grow_table(t);
+    }
+
+    // Look for the pattern's bucket in the table, stopping at the first empty slot
+    uint32_t mask = t->slots_size - 1;
+    uint32_t slot = patternKey(n, pattern) & mask;
+    while (t->slots[slot]) {
+        struct bucket* b = t->buckets + t->slots[slot] - 1;
 
-            return;
+        // If patterns match, this is the bucket
+        if (b->len == n && memcmp(pattern, b->pattern, n) == 0) {
+            return b;
         }
 
-        head = head->next;
+        slot = (slot + 1) & mask;
     }
 
-    // No pattern found in list - add pattern to the list
-    new_pattern_node(n);
-    add_word_to_pattern(list, n);
+    // No pattern found - make a new bucket in the empty slot
+    t->slots[slot] = new_bucket(t, n, pattern) + 1;
+    return t->buckets + t->slots[slot] - 1;
 }
 
 /**
- * @brief Allocate a new linked list node to hold the pattern currently in pattern
- * buffer, then add this to the current list of patterns
+ * @brief Double the size of a table's hash table (or create it) and re-insert every bucket
  */
-void new_pattern_node(int n) {
-    num_patterns++;
+void grow_table(struct table* t) {
+    uint32_t old_size = t->slots_size;
+    resize(t->slots, old_size * sizeof(uint32_t), 0);
+
+    t->slots_size = old_size ? old_size * 2 : 1024;
+    t->slots = resize(NULL, 0, t->slots_size * sizeof(uint32_t));
+    memset(t->slots, 0, t->slots_size * sizeof(uint32_t));
+
+    uint32_t mask = t->slots_size - 1;
+    for (uint32_t i = 0; i < t->num_patterns; i++) {
+        uint32_t slot = patternKey(t->buckets[i].len, t->buckets[i].pattern) & mask;
+        while (t->slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
 
-    // Allocate node
-    struct pattern_list_node* node = malloc(sizeof(struct pattern_list_node));
-    if (!node) {
-        perror("Failed to allocate pattern list node");
-        exit(EXIT_FAILURE);
+        t->slots[slot] = i + 1;
     }
+}
 
-    // Fill simple values, including tail of list, allocate memory for pattern
-    node->len = n;
-    node->next = list;
-    node->list = NULL;
-    node->pattern = malloc(n);
-    node->num = 0;
-
-    if (!node->pattern) {
-        perror("Failed to allocate string for pattern");
-        exit(EXIT_FAILURE);
+/**
+ * @brief Make a new bucket in a table to hold a pattern
+ * @return uint32_t number of the new bucket
+ */
+uint32_t new_bucket(struct table* t, int n, char *pattern) {
+    // Make room for it
+    if (t->num_patterns == t->buckets_size) {
+        uint32_t size = t->buckets_size ? t->buckets_size * 2 : 1024;
+        t->buckets = resize(t->buckets, t->buckets_size * sizeof(struct bucket), size * sizeof(struct bucket));
+        t->buckets_size = size;
     }
 
-    // Copy over the pattern
-    memcpy(node->pattern, pattern_buffer, n);
+    struct bucket* b = t->buckets + t->num_patterns;
 
-    // Set this mode as the new head of the lsit
-    list = node;
+    // Fill simple values and copy over the pattern
+    b->len = n;
+    b->pattern = resize(NULL, 0, n);
+    memcpy(b->pattern, pattern, n);
+    b->words = NULL;
+    b->weights = NULL;
+    b->num = 0;
+    b->capacity = 0;
 
     #if DEBUG
-        printf("new pattern node %d ", list->num);
-        for (int i = 0; i < list->len; i++) {
-            printf("%d ", list->pattern[i]);
+        printf("new bucket %d ", t->num_patterns);
+        for (int i = 0; i < b->len; i++) {
+            printf("%d ", b->pattern[i]);
         }
         printf("\n");
     #endif
+
+    return t->num_patterns++;
 }
 
 /**
- * @brief Add the word held in buffer to the pattern list node provided.
+ * @brief Add words to the end of the bucket provided.
+ * @param b bucket to add to
+ * @param words one or more words one after another
+ * @param weights weight of each word, or NULL to give each a weight of 1
+ * @param n number of characters of words to add, a multiple of the bucket's length
  */
-void add_word_to_pattern(struct pattern_list_node* node, int n) {
-    // Allocate new word list node to hold the word
-    struct word_list_node* wln = malloc(sizeof(struct word_list_node));
-    if (!wln) {
-        perror("Failed to allocate word list node");
-        exit(EXIT_FAILURE);
-    }
-
-    // Set as head of the list
-    wln->next = node->list;
-    node->list = wln;
-    
-    node->num++;
+void add_word_to_bucket(struct bucket* b, char *words, uint32_t *weights, size_t n) {
+    uint32_t num = n / b->len;
+
+    // Grow the bucket's words as a whole when it is full
+    if (b->num + num > b->capacity) {
+        uint32_t capacity = b->capacity ? b->capacity : 4;
+        while (capacity < b->num + num) {
+            capacity *= 2;
+        }
 
-    // Allocate memory for word
-    wln->word = malloc(n + 1);
-    if (!wln->word) {
-        perror("Failed to allocate string for word");
-        exit(EXIT_FAILURE);
+        b->words = resize(b->words, (size_t) b->capacity * b->len, (size_t) capacity * b->len);
+        b->weights = resize(b->weights, (size_t) b->capacity * 4, (size_t) capacity * 4);
+        b->capacity = capacity;
     }
-    
+
     // Copy over
-    memcpy(wln->word, buffer, n);
-    wln->word[n] = 0;
+    memcpy(b->words + (size_t) b->num * b->len, words, n);
+    for (uint32_t w = 0; w < num; w++) {
+        b->weights[b->num + w] = weights ? weights[w] : 1;
+    }
+    b->num += num;
 
     #if DEBUG
-        printf("new word node %s\n", node->list->word);
+        printf("new words %.*s\n", (int) n, words);
     #endif
 }
 
 /**
- * @brief Output the words and patterns to standard out.
- * Will not save any files 
+ * @brief Add every word of one table to another.
+ * The words of each pattern are added after any the table already holds, and patterns
+ * the table does not have yet are added in the order they were first seen
  */
-void outputStd() {
-    while (list) {
-        // Print out pattern
-        printf("'");
-        for (int i = 0; i < list->len; i++) {
-            printf("%d ", list->pattern[i]);
+void merge(struct table* into, struct table* from) {
+    for (uint32_t i = 0; i < from->num_patterns; i++) {
+        struct bucket* b = from->buckets + i;
+        add_word_to_bucket(find_bucket(into, b->len, b->pattern), b->words, b->weights, (size_t) b->num * b->len);
+    }
+
+    into->weighted |= from->weighted;
+}
+
+/**
+ * @brief Release the buckets, words and hash table of a table
+ */
+void free_table(struct table* t) {
+    for (uint32_t i = 0; i < t->num_patterns; i++) {
+        resize(t->buckets[i].words, (size_t) t->buckets[i].capacity * t->buckets[i].len, 0);
+        resize(t->buckets[i].weights, (size_t) t->buckets[i].capacity * 4, 0);
+        resize(t->buckets[i].pattern, t->buckets[i].len, 0);
+    }
+    resize(t->buckets, t->buckets_size * sizeof(struct bucket), 0);
+    resize(t->slots, t->slots_size * sizeof(uint32_t), 0);
+
+    memset(t, 0, sizeof(struct table));
+}
+
+/**
+ * @brief Change the size of an allocation, keeping track of the memory in use.
+ * Exits if the memory cannot be allocated. Safe to use from any thread
+ * @param p allocation to resize, or NULL for a new one
+ * @param old_size current size of the allocation
+ * @param size new size, or zero to free the allocation
+ * @return void* the resized allocation
+ */
+void* resize(void *p, size_t old_size, size_t size) {
+    size_t used = atomic_fetch_add(&memory_used, size - old_size) + size - old_size;
+
+    size_t peak = atomic_load(&memory_peak);
+    while (used > peak && !atomic_compare_exchange_weak(&memory_peak, &peak, used));
+
+    if (size == 0) {
+        free(p);
+        return NULL;
+    }
+
+    p = realloc(p, size);
+    if (!p) {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+/**
+ * @brief Report the time taken and the most memory used to hold the dictionary.
+ * Written to standard error so it does not mix with the output of test mode
+ * @param start time the program started
+ * @param threads number of threads the input was read with
+ */
+void report(struct timespec *start, int threads) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    double seconds = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+    uint64_t num_words = 0;
+    for (uint32_t i = 0; i < patterns.num_patterns; i++) {
+        num_words += patterns.buckets[i].num;
+    }
+
+    fprintf(stderr, "%" PRIu64 " words in %u patterns\n", num_words, patterns.num_patterns);
+    fprintf(stderr, "Wall time: %.3f s (%d thread%s)\n", seconds, threads, threads == 1 ? "" : "s");
+    fprintf(stderr, "Peak memory: %.1f MB\n", atomic_load(&memory_peak) / (1024.0 * 1024.0));
+}
+
+/**
+ * @brief Write the words which are not already in the store as its next delta segment
+ */
+void outputDelta() {
+    struct data_store *ds = readStore(directory);
+
+    // Drop the words the store has, and any patterns left with no words
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < patterns.num_patterns; i++) {
+        struct bucket* b = patterns.buckets + i;
+
+        int id = lookupPattern(ds, b->len, b->pattern);
+        if (id >= 0) {
+            uint32_t num = 0;
+            for (uint32_t w = 0; w < b->num; w++) {
+                char *word = b->words + (size_t) w * b->len;
+                if (!hasWord(ds->patterns + id, word)) {
+                    memmove(b->words + (size_t) num * b->len, word, b->len);
+                    b->weights[num] = b->weights[w];
+                    num++;
+                }
+            }
+            b->num = num;
+        }
+
+        if (b->num > 0) {
+            patterns.buckets[kept++] = *b;
+        } else {
+            resize(b->words, (size_t) b->capacity * b->len, 0);
+            resize(b->weights, (size_t) b->capacity * 4, 0);
+            resize(b->pattern, b->len, 0);
         }
-        printf("' (%d words)\n", list->num);
+    }
+    patterns.num_patterns = kept;
+
+    // The hash table no longer matches the buckets and is not needed again
+    resize(patterns.slots, patterns.slots_size * sizeof(uint32_t), 0);
+    patterns.slots = NULL;
+    patterns.slots_size = 0;
+
+    // New words only have a place among the store's words by frequency if the segment
+    // keeps their weights too. Those without a frequency have a weight of one
+    patterns.weighted = ds->weights != NULL;
+
+    int k = ds->deltas + 1;
+    freeDataStore(ds);
+
+    if (kept == 0) {
+        fprintf(stderr, "No new words - no delta segment written\n");
+        return;
+    }
+
+    char *words_file = storeFile(directory, "words", k);
+    char *index_file = storeFile(directory, "patternIndex", k);
 
-        // Print out each word in this pattern's list
-        while (list->list) {
-            printf("\t%s\n", list->list->word);
+    outputFile(words_file, index_file, k, 0);
 
-            // Free this word node and move to the next
+    free(words_file);
+    free(index_file);
 
-            struct word_list_node* next = list->list->next;
+    fprintf(stderr, "Wrote delta segment %d\n", k);
+}
 
-            free(list->list->word);
-            free(list->list);
+/**
+ * @brief Check whether a word is in any segment of a pattern in the store
+ */
+char hasWord(struct pattern* p, char *word) {
+    char letters[p->len];
+    for (; p; p = p->next) {
+        uint64_t num = (p->end - p->start) / p->len;
+        for (uint64_t w = 0; w < num; w++) {
+            if (memcmp(patternWord(p, w, letters), word, p->len) == 0) {
+                return 1;
+            }
+        }
+    }
 
-            list->list = next;
+    return 0;
+}
+
+/**
+ * @brief Load every word of the store, including its delta segments, into the table.
+ * The table is filled so that outputFile writes the patterns in the store's order, with
+ * each pattern's words in the base store first followed by those of each delta segment
+ * @return int number of delta segments the store had
+ */
+int loadStore() {
+    struct data_store *ds = readStore(directory);
+
+    // outputFile writes the newest pattern and word first, so add them in reverse
+    struct pattern** segments = NULL;
+    int segments_size = 0;
+    for (uint32_t i = ds->num_patterns; i-- > 0;) {
+        // Gather the pattern's segments so they can be read last first
+        int n = 0;
+        for (struct pattern* p = ds->patterns + i; p; p = p->next) {
+            if (n == segments_size) {
+                segments_size = segments_size ? segments_size * 2 : 8;
+                segments = realloc(segments, segments_size * sizeof(struct pattern*));
+                if (!segments) {
+                    perror("Failed to allocate segments");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            segments[n++] = p;
         }
 
-        // Free this node and move to the next
+        struct pattern* p = ds->patterns + i;
+        struct bucket* b = find_bucket(&patterns, p->len, p->pattern);
+        char letters[p->len];
+        while (n-- > 0) {
+            for (uint64_t w = (segments[n]->end - segments[n]->start) / p->len; w-- > 0;) {
+                uint32_t *weight = NULL;
+                if (segments[n]->weights) {
+                    weight = segments[n]->weights + w;
+                }
+                add_word_to_bucket(b, patternWord(segments[n], w, letters), weight, p->len);
+            }
+        }
+    }
+    free(segments);
+
+    patterns.weighted = ds->weights != NULL;
+
+    int deltas = ds->deltas;
+
+    // Unmap before the files are replaced
+    freeDataStore(ds);
+
+    return deltas;
+}
+
+/**
+ * @brief Delete the files of the delta segments once they are part of the base store
+ */
+void removeDeltas(int deltas) {
+    for (int k = 1; k <= deltas; k++) {
+        char *file_name = storeFile(directory, "patternIndex", k);
+        remove(file_name);
+        free(file_name);
+
+        file_name = storeFile(directory, "words", k);
+        remove(file_name);
+        free(file_name);
+
+        file_name = storeFile(directory, "weights", k);
+        remove(file_name);
+        free(file_name);
+    }
 
-        struct pattern_list_node* next = list->next;
+    if (deltas) {
+        fprintf(stderr, "Folded %d delta segment%s into the store\n", deltas, deltas == 1 ? "" : "s");
+    }
+}
 
-        free(list->pattern);
-        free(list);
+/**
+ * @brief Output the words and patterns to standard out.
+ * Patterns are output newest first and each pattern's words newest first.
+ * Will not save any files 
+ */
+void outputStd() {
+    for (uint32_t i = patterns.num_patterns; i-- > 0;) {
+        struct bucket* b = patterns.buckets + i;
 
-        list = next;
+        // Print out pattern
+        printf("'");
+        for (int j = 0; j < b->len; j++) {
+            printf("%d ", b->pattern[j]);
+        }
+        printf("' (%d words)\n", b->num);
+
+        // Print out each word in this pattern's bucket, with its weight if there are any
+        for (uint32_t w = b->num; w-- > 0;) {
+            if (patterns.weighted) {
+                printf("\t%.*s %u\n", b->len, b->words + (size_t) w * b->len, b->weights[w]);
+            } else {
+                printf("\t%.*s\n", b->len, b->words + (size_t) w * b->len);
+            }
+        }
     }
 }
 
 /**
- * @brief Output the patterns and words to the correct files.
- * Will output to data/words and data/patternIndex
+ * @brief Output the patterns and words to the correct files in the version 2 format.
+ * Each file is written under a temporary name then renamed over the old one, so
+ * programs already using the old files are not disturbed
+ * @param words_file name of the words file to write
+ * @param index_file name of the pattern index to write
+ * @param segment 0 for the base store, k for delta segment k. When the words have weights
+ * the weights file is written for either, named with .k added for a segment
+ * @param extras 1 to also write the postings (or, when asked for, columns), masks and
+ * summary files to the store's directory, with the packed words file in place of the
+ * words file when asked for. 0 for only the words file, the index and any weights
  */
-void outputFile() {
-    // Create/Open the two output files
+void outputFile(char *words_file, char *index_file, int segment, char extras) {
+    uint32_t num_patterns = patterns.num_patterns;
+    struct bucket* buckets = patterns.buckets;
+
+    // Create/Open the output files
+
+    FILE *wf = extras && pack ? NULL : openOutput(words_file);
+    FILE *pf = openOutput(index_file);
+    char *postings_file = storeFile(directory, "postings", 0);
+    char *masks_file = storeFile(directory, "masks", 0);
+    char *packed_file = storeFile(directory, "packed", 0);
+    char *weights_file = storeFile(directory, "weights", segment);
+    char *columns_file = storeFile(directory, "columns", 0);
+    char *summary_file = storeFile(directory, "summary", 0);
+
+    FILE *bf = extras && !columns ? openOutput(postings_file) : NULL;
+    FILE *mf = extras ? openOutput(masks_file) : NULL;
+    FILE *kf = extras && pack ? openOutput(packed_file) : NULL;
+    FILE *tf = patterns.weighted ? openOutput(weights_file) : NULL;
+    FILE *cf = extras && columns ? openOutput(columns_file) : NULL;
+    FILE *sf = extras ? openOutput(summary_file) : NULL;
+
+    // Weights left from an earlier dictionary would otherwise be used if the words match
+    if (!tf) {
+        remove(weights_file);
+    }
 
-    FILE *wf = fopen("data/words", "wb");
-    if (!wf) {
-        perror("Failed to open words file");
+    // As would postings or columns, whichever has not been asked for this time, and the
+    // words or packed words
+    if (extras && !bf) {
+        remove(postings_file);
+    }
+    if (extras && !cf) {
+        remove(columns_file);
+    }
+    if (extras && !wf) {
+        remove(words_file);
+    }
+    if (extras && !kf) {
+        remove(packed_file);
+    }
+
+    // Leave room for the weights header, filled in once the checksum is known
+    if (tf && fseek(tf, SECTION_HEADER_SIZE, SEEK_SET) != 0) {
+        perror("Failed to seek in weights file");
         exit(EXIT_FAILURE);
     }
 
-    FILE *pf = fopen("data/patternIndex", "wb");
-    if (!pf) {
-        perror("Failed to open patternIndex file");
+    // Leave room for the letter set header, filled in once the checksum is known
+    if (mf && fseek(mf, SECTION_HEADER_SIZE, SEEK_SET) != 0) {
+        perror("Failed to seek in masks file");
         exit(EXIT_FAILURE);
     }
 
-    // Write number of patterns to pattern index file
-    num_patterns = htonl(num_patterns);
-    if (fwrite(&num_patterns, 4, 1, pf) != 1) {
-        perror("Failed to write num_patterns");
+    // Leave room for the postings header and table, filled in once the checksum is known
+    uint64_t *postings = calloc(num_patterns + 1, 8);
+    if (!postings) {
+        perror("Failed to allocate postings table");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t bi = SECTION_HEADER_SIZE + (uint64_t) num_patterns * 8;
+    if (bf && fseek(bf, bi, SEEK_SET) != 0) {
+        perror("Failed to seek in postings file");
         exit(EXIT_FAILURE);
     }
-    num_patterns = ntohl(num_patterns);
 
-    // The index currently being written to in the words list
-    uint32_t wi = 0;
+    // Leave room for the packed words header and table in the same way
+    uint64_t *packed = calloc(num_patterns + 1, 8);
+    if (!packed) {
+        perror("Failed to allocate packed words table");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t ki = SECTION_HEADER_SIZE + (uint64_t) num_patterns * 8;
+    if (kf && fseek(kf, ki, SEEK_SET) != 0) {
+        perror("Failed to seek in packed words file");
+        exit(EXIT_FAILURE);
+    }
 
-    while (list) {
-        // Write the pattern record
+    // And for the columns header and table
+    uint64_t *column_table = calloc(num_patterns + 1, 8);
+    if (!column_table) {
+        perror("Failed to allocate columns table");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t ci = SECTION_HEADER_SIZE + (uint64_t) num_patterns * 8;
+    if (cf && fseek(cf, ci, SEEK_SET) != 0) {
+        perror("Failed to seek in columns file");
+        exit(EXIT_FAILURE);
+    }
 
-        // length of pattern
-        if (fwrite(&(list->len), 1, 1, pf) != 1) {
-            perror("Failed to write len");
-            exit(EXIT_FAILURE);
-        }
+    // And for the summary header and table
+    uint64_t *summary = calloc(num_patterns + 1, 8);
+    if (!summary) {
+        perror("Failed to allocate summary table");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t si = SECTION_HEADER_SIZE + (uint64_t) num_patterns * 8;
+    if (sf && fseek(sf, si, SEEK_SET) != 0) {
+        perror("Failed to seek in summary file");
+        exit(EXIT_FAILURE);
+    }
+
+    // The pattern table and the pattern strings following it are built in memory
+    // while the words are written, then written out after the header
+    size_t table_size = (size_t) num_patterns * INDEX_ENTRY_SIZE;
+    size_t body_size = table_size;
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        body_size += buckets[i].len;
+    }
+
+    char *body = malloc(body_size);
+    if (!body) {
+        perror("Failed to allocate pattern index");
+        exit(EXIT_FAILURE);
+    }
 
-        // pattern
-        if (fwrite(list->pattern, 1, list->len, pf) != list->len) {
-            perror("Failed to write pattern");
+    char *entry = body;
+    size_t pattern_offset = table_size;
+
+    // Zeros written before each pattern's words to align them
+    char padding[BUCKET_ALIGN] = {0};
+
+    // The index currently being written to in the words list, and the number of words
+    // written so far
+    uint64_t wi = 0;
+    uint64_t num_words = 0;
+
+    uint64_t hash = CHECKSUM_BASIS;
+
+    // Number of the pattern being written. Buckets are written newest first
+    uint32_t pi = 0;
+
+    for (uint32_t bn = num_patterns; bn-- > 0;) {
+        struct bucket* b = buckets + bn;
+
+        // Start this pattern's words on an aligned boundary
+        size_t pad = (BUCKET_ALIGN - (wi % BUCKET_ALIGN)) % BUCKET_ALIGN;
+        if (wf && fwrite(padding, 1, pad, wf) != pad) {
+            perror("Failed to write padding");
             exit(EXIT_FAILURE);
         }
+        hash = checksum(hash, padding, pad);
+        wi += pad;
+
+        // Fill the pattern table entry and copy the pattern after the table
+        putU64(entry, wi);
+        putU64(entry + 8, b->num);
+        putU64(entry + 16, num_words);
+        putU32(entry + 24, b->len);
+        putU32(entry + 28, INDEX_HEADER_SIZE + pattern_offset);
+        entry += INDEX_ENTRY_SIZE;
+
+        memcpy(body + pattern_offset, b->pattern, b->len);
+        pattern_offset += b->len;
 
         #if DEBUG
-            for (int i = 0; i < list->len; i++) {
-                printf("%d ", list->pattern[i]);
+            for (int i = 0; i < b->len; i++) {
+                printf("%d ", b->pattern[i]);
             }
-            printf("written\n");
+            printf("written at %" PRIu64 "\n", wi);
         #endif
 
-        // index
-        wi = htonl(wi);
-        if (fwrite(&wi, 4, 1, pf) != 1) {
-            perror("Failed to write index");
+        // Index the words by letter if there are enough to be worth it
+        if (bf && b->num >= POSTINGS_MIN_WORDS) {
+            postings[pi] = outputPostings(bf, b, &bi);
+        }
+        if (kf) {
+            packed[pi] = outputPacked(kf, b, &ki);
+        }
+        if (cf) {
+            column_table[pi] = outputColumns(cf, b, &ci);
+        }
+        if (sf && b->num >= SUMMARY_MIN_WORDS) {
+            summary[pi] = outputSummary(sf, b, &si);
+        }
+        pi++;
+
+        // Write the bucket's words, newest first
+        for (uint32_t w = b->num; w-- > 0;) {
+            char *word = b->words + (size_t) w * b->len;
+
+            // write word, whose place is kept in the index and checksum even when packed
+            if (wf && fwrite(word, 1, b->len, wf) != (size_t) b->len) {
+                perror("Failed to write word");
+                exit(EXIT_FAILURE);
+            }
+            hash = checksum(hash, word, b->len);
+
+            // write the set of letters in the word
+            uint32_t mask = 0;
+            for (int i = 0; i < b->len; i++) {
+                mask |= 0x1 << (word[i] - 'a');
+            }
+            if (mf && fwrite(&mask, 4, 1, mf) != 1) {
+                perror("Failed to write mask");
+                exit(EXIT_FAILURE);
+            }
+
+            // write the word's weight
+            if (tf && fwrite(b->weights + w, 4, 1, tf) != 1) {
+                perror("Failed to write weight");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // advance word list pointer
+        wi += (uint64_t) b->num * b->len;
+        num_words += b->num;
+    }
+
+    hash = checksum(hash, body, body_size);
+
+    // Write the header followed by the table and patterns
+    char header[INDEX_HEADER_SIZE] = {0};
+    memcpy(header, INDEX_MAGIC, 4);
+    putU32(header + 4, INDEX_VERSION);
+    putU32(header + 8, num_patterns);
+    putU64(header + 16, num_words);
+    putU64(header + 24, wi);
+    putU64(header + 32, hash);
+
+    if (fwrite(header, 1, INDEX_HEADER_SIZE, pf) != INDEX_HEADER_SIZE) {
+        perror("Failed to write index header");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fwrite(body, 1, body_size, pf) != body_size) {
+        perror("Failed to write pattern table");
+        exit(EXIT_FAILURE);
+    }
+
+    free(body);
+
+    if (bf) {
+        // Write the postings header and table
+        rewind(bf);
+        writeSectionHeader(bf, POSTINGS_MAGIC, POSTINGS_VERSION, hash);
+        if (fwrite(postings, 8, num_patterns, bf) != num_patterns) {
+            perror("Failed to write postings table");
             exit(EXIT_FAILURE);
         }
-        wi = ntohl(wi);
 
-        #if DEBUG
-            printf("wi %d %x\n", wi, *(&wi));
-        #endif
+        closeOutput(bf, postings_file);
+    }
 
-        // number of words
-        list->num = htonl(list->num);
-        if (fwrite(&(list->num), 4, 1, pf) != 1) {
-            perror("Failed to write num");
+    free(postings);
+
+    if (tf) {
+        rewind(tf);
+        writeSectionHeader(tf, WEIGHTS_MAGIC, WEIGHTS_VERSION, hash);
+
+        closeOutput(tf, weights_file);
+    }
+
+    if (kf) {
+        // Spare unit read past the end of the last pattern
+        uint64_t spare = 0;
+        if (fwrite(&spare, 8, 1, kf) != 1) {
+            perror("Failed to write packed words");
             exit(EXIT_FAILURE);
         }
-        list->num = ntohl(list->num);
 
-        // Write list of words
+        rewind(kf);
+        writeSectionHeader(kf, PACKED_MAGIC, PACKED_VERSION, hash);
+        if (fwrite(packed, 8, num_patterns, kf) != num_patterns) {
+            perror("Failed to write packed words table");
+            exit(EXIT_FAILURE);
+        }
 
-        while (list->list) {
-            // write word
-            if (fwrite(list->list->word, 1, list->len, wf) != list->len) {
-                perror("Failed to write word");
-                exit(EXIT_FAILURE);
+        closeOutput(kf, packed_file);
+    }
+
+    free(packed);
+
+    if (cf) {
+        // Spare bytes read past the end of the last pattern
+        char spare[64] = {0};
+        if (fwrite(spare, 1, 64, cf) != 64) {
+            perror("Failed to write columns");
+            exit(EXIT_FAILURE);
+        }
+
+        rewind(cf);
+        writeSectionHeader(cf, COLUMNS_MAGIC, COLUMNS_VERSION, hash);
+        if (fwrite(column_table, 8, num_patterns, cf) != num_patterns) {
+            perror("Failed to write columns table");
+            exit(EXIT_FAILURE);
+        }
+
+        closeOutput(cf, columns_file);
+    }
+
+    free(column_table);
+
+    if (sf) {
+        rewind(sf);
+        writeSectionHeader(sf, SUMMARY_MAGIC, SUMMARY_VERSION, hash);
+        if (fwrite(summary, 8, num_patterns, sf) != num_patterns) {
+            perror("Failed to write summary table");
+            exit(EXIT_FAILURE);
+        }
+
+        closeOutput(sf, summary_file);
+    }
+
+    free(summary);
+
+    if (mf) {
+        rewind(mf);
+        writeSectionHeader(mf, MASKS_MAGIC, MASKS_VERSION, hash);
+
+        closeOutput(mf, masks_file);
+    }
+
+    closeOutput(pf, index_file);
+    if (wf) {
+        closeOutput(wf, words_file);
+    }
+
+    free(postings_file);
+    free(masks_file);
+    free(packed_file);
+    free(weights_file);
+    free(columns_file);
+    free(summary_file);
+}
+
+/**
+ * @brief Open a file for writing under a temporary name: the file name with ".tmp" added.
+ * closeOutput gives it its real name
+ */
+FILE* openOutput(char *file_name) {
+    char *temp = tempName(file_name);
+
+    FILE *fp = fopen(temp, "wb");
+    if (!fp) {
+        printf("Failed to open '%s' for writing\n", temp);
+        exit(EXIT_FAILURE);
+    }
+
+    free(temp);
+
+    return fp;
+}
+
+/**
+ * @brief Close a file opened by openOutput and rename it over the file it replaces
+ */
+void closeOutput(FILE *fp, char *file_name) {
+    if (fclose(fp) != 0) {
+        perror("Failed to finish writing");
+        exit(EXIT_FAILURE);
+    }
+
+    char *temp = tempName(file_name);
+
+    // Renaming over an existing file is not allowed on Windows
+    #ifdef _WIN32
+    remove(file_name);
+    #endif
+
+    if (rename(temp, file_name) != 0) {
+        printf("Failed to rename '%s' to '%s'\n", temp, file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    free(temp);
+}
+
+/**
+ * @brief Allocate the temporary name used while writing a file
+ */
+char* tempName(char *file_name) {
+    char *temp = malloc(strlen(file_name) + 5);
+    if (!temp) {
+        perror("Failed to allocate file name");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(temp, file_name);
+    strcat(temp, ".tmp");
+
+    return temp;
+}
+
+/**
+ * @brief Write a bitset for each position and letter of a pattern to the postings file.
+ * Bit w of the bitset for a position and letter is set when word w of the pattern has
+ * that letter in that position
+ * @param bf postings file, positioned at the current end of the file
+ * @param b pattern to index
+ * @param bi current end of the postings file, advanced past the bitsets
+ * @return uint64_t location of the bitsets in the postings file
+ */
+uint64_t outputPostings(FILE *bf, struct bucket* b, uint64_t *bi) {
+    uint64_t blocks = (b->num + 63) / 64;
+    size_t n = (size_t) b->len * 26 * blocks;
+
+    uint64_t *bits = calloc(n, 8);
+    if (!bits) {
+        perror("Failed to allocate postings");
+        exit(EXIT_FAILURE);
+    }
+
+    // Words are written newest first so word w is the w-th from the end of the bucket
+    for (uint64_t w = 0; w < b->num; w++) {
+        char *word = b->words + (size_t) (b->num - 1 - w) * b->len;
+
+        for (int i = 0; i < b->len; i++) {
+            int l = word[i] - 'a';
+            bits[(i * 26 + l) * blocks + w / 64] |= (uint64_t) 1 << (w % 64);
+        }
+    }
+
+    // Start on a cache line like the words
+    char padding[BUCKET_ALIGN] = {0};
+    size_t pad = (BUCKET_ALIGN - (*bi % BUCKET_ALIGN)) % BUCKET_ALIGN;
+    if (fwrite(padding, 1, pad, bf) != pad) {
+        perror("Failed to write padding");
+        exit(EXIT_FAILURE);
+    }
+    *bi += pad;
+
+    uint64_t at = *bi;
+    if (fwrite(bits, 8, n, bf) != n) {
+        perror("Failed to write postings");
+        exit(EXIT_FAILURE);
+    }
+    *bi += n * 8;
+
+    free(bits);
+
+    return at;
+}
+
+/**
+ * @brief Write a pattern's words to the packed words file, 5 bits per letter
+ * @param kf packed words file, positioned at the current end of the file
+ * @param b pattern to pack
+ * @param ki current end of the packed words file, advanced past the words
+ * @return uint64_t location of the words in the packed words file
+ */
+uint64_t outputPacked(FILE *kf, struct bucket* b, uint64_t *ki) {
+    size_t n = ((uint64_t) b->num * b->len * PACKED_BITS + 63) / 64;
+
+    uint64_t *units = calloc(n, 8);
+    if (!units) {
+        perror("Failed to allocate packed words");
+        exit(EXIT_FAILURE);
+    }
+
+    // Words are written newest first, as in the words file
+    uint64_t bit = 0;
+    for (uint32_t w = b->num; w-- > 0;) {
+        char *word = b->words + (size_t) w * b->len;
+
+        for (int i = 0; i < b->len; i++, bit += PACKED_BITS) {
+            uint64_t l = word[i] - 'a';
+            int shift = bit % 64;
+
+            units[bit / 64] |= l << shift;
+            if (shift > 64 - PACKED_BITS) {
+                units[bit / 64 + 1] |= l >> (64 - shift);
             }
+        }
+    }
+
+    // Units are whole, so the words always start on a unit after the header and table
+    uint64_t at = *ki;
+    if (fwrite(units, 8, n, kf) != n) {
+        perror("Failed to write packed words");
+        exit(EXIT_FAILURE);
+    }
+    *ki += n * 8;
 
-            // free memory, next
-            struct word_list_node* next = list->list->next;
-            free(list->list->word);
-            free(list->list);
-            list->list = next;
+    free(units);
+
+    return at;
+}
+
+/**
+ * @brief Write a pattern's words to the columns file by position: the first letter of
+ * every word, then the second and so on
+ * @param cf columns file, positioned at the current end of the file
+ * @param b pattern to write
+ * @param ci current end of the columns file, advanced past the columns
+ * @return uint64_t location of the columns in the columns file
+ */
+uint64_t outputColumns(FILE *cf, struct bucket* b, uint64_t *ci) {
+    size_t n = (size_t) b->num * b->len;
+
+    char *letters = malloc(n);
+    if (!letters) {
+        perror("Failed to allocate columns");
+        exit(EXIT_FAILURE);
+    }
+
+    // Words are written newest first, as in the words file
+    for (uint64_t w = 0; w < b->num; w++) {
+        char *word = b->words + (size_t) (b->num - 1 - w) * b->len;
+
+        for (int i = 0; i < b->len; i++) {
+            letters[i * b->num + w] = word[i];
         }
+    }
 
-        // advance word list pointer
-        wi += list->num * list->len;
+    // Start on a cache line like the words
+    char padding[BUCKET_ALIGN] = {0};
+    size_t pad = (BUCKET_ALIGN - (*ci % BUCKET_ALIGN)) % BUCKET_ALIGN;
+    if (fwrite(padding, 1, pad, cf) != pad) {
+        perror("Failed to write padding");
+        exit(EXIT_FAILURE);
+    }
+    *ci += pad;
+
+    uint64_t at = *ci;
+    if (fwrite(letters, 1, n, cf) != n) {
+        perror("Failed to write columns");
+        exit(EXIT_FAILURE);
+    }
+    *ci += n;
+
+    free(letters);
+
+    return at;
+}
+
+/**
+ * @brief Write a summary of a pattern's words to the summary file: the total weight of
+ * the words, the weight of the heaviest, the total weight of the words with each letter
+ * at each position and the set of letters found at each position
+ * @param sf summary file, positioned at the current end of the file
+ * @param b pattern to summarise
+ * @param si current end of the summary file, advanced past the summary
+ * @return uint64_t location of the summary in the summary file
+ */
+uint64_t outputSummary(FILE *sf, struct bucket* b, uint64_t *si) {
+    size_t n = 2 + (size_t) b->len * 26;
+
+    uint64_t *weights = calloc(n, 8);
+    uint32_t *letters = calloc(b->len + 1, 4);
+    if (!weights || !letters) {
+        perror("Failed to allocate summary");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t w = 0; w < b->num; w++) {
+        char *word = b->words + (size_t) w * b->len;
+        uint64_t weight = b->weights[w];
 
-        // Free memory and move to next
+        weights[0] += weight;
+        if (weight > weights[1]) {
+            weights[1] = weight;
+        }
 
-        struct pattern_list_node* next = list->next;
-        free(list->pattern);
-        free(list);
-        list = next;
+        for (int i = 0; i < b->len; i++) {
+            int l = word[i] - 'a';
+            weights[2 + i * 26 + l] += weight;
+            letters[i] |= 0x1 << l;
+        }
     }
 
-    fclose(pf);
-    fclose(wf);
+    // The sets are padded to a whole unit so the next summary is aligned
+    size_t sets = (b->len + 1) / 2 * 2;
+
+    uint64_t at = *si;
+    if (fwrite(weights, 8, n, sf) != n || fwrite(letters, 4, sets, sf) != sets) {
+        perror("Failed to write summary");
+        exit(EXIT_FAILURE);
+    }
+    *si += n * 8 + sets * 4;
+
+    free(weights);
+    free(letters);
+
+    return at;
+}
+
+/**
+ * @brief Write the header of one of the optional files belonging to a store.
+ * Apart from the magic bytes, the header is in this machine's byte order
+ * @param fp file to write to, positioned at its start
+ * @param magic the file's magic bytes
+ * @param version version of the file's contents
+ * @param sum checksum of the store the file belongs to
+ */
+void writeSectionHeader(FILE *fp, char *magic, uint32_t version, uint64_t sum) {
+    char header[SECTION_HEADER_SIZE] = {0};
+    uint32_t fields[3] = {version, SECTION_BYTE_ORDER, 0};
+
+    memcpy(header, magic, 4);
+    memcpy(header + 4, fields, 12);
+    memcpy(header + 16, &sum, 8);
+
+    if (fwrite(header, 1, SECTION_HEADER_SIZE, fp) != SECTION_HEADER_SIZE) {
+        perror("Failed to write header");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Store an unsigned 64-bit integer in network order at any alignment
+ */
+void putU64(char *b, uint64_t n) {
+    putU32(b, n >> 32);
+    putU32(b + 4, n & 0xFFFFFFFF);
+}
+
+/**
+ * @brief Store an unsigned 32-bit integer in network order at any alignment
+ */
+void putU32(char *b, uint32_t n) {
+    n = htonl(n);
+    memcpy(b, &n, 4);
 }
@@ -1,24 +1,75 @@
 
-struct word_list_node {
-    char *word;
-    struct word_list_node* next;
-};
-
-struct pattern_list_node {
-    char len;
+// A pattern and the words which have it. The words are stored one after another in a
+// single allocation which grows as words are added, with their weights alongside
+struct bucket {
+    int len;
     char *pattern;
-    struct word_list_node* list;
-    struct pattern_list_node* next;
+    char *words;
+    uint32_t *weights;
     uint32_t num;
+    uint32_t capacity; // number of words there is room for
 };
 
-void input(char *file_name);
-void get_pattern();
-void add_pattern();
-void new_pattern_node(int n);
-void add_word_to_pattern(struct pattern_list_node* node, int n);
+// A table of patterns, each with a bucket of words, found in some of the input.
+// Buckets are in the order their patterns were first seen
+struct table {
+    struct bucket* buckets;
+    uint32_t buckets_size;
+    uint32_t num_patterns;
+
+    // Open addressed hash table from pattern to bucket. Each slot holds the number of
+    // the bucket plus one, or zero when empty. The size is a power of two
+    uint32_t *slots;
+    uint32_t slots_size;
+
+    // Set to 1 once any word has been given a weight
+    char weighted;
+};
+
+// Part of the input, read by one thread into its own table
+struct chunk {
+    char *start;
+    char *end; // location of byte immediately following the chunk
+    struct table table;
+};
+
+// Most threads that can be used to read the input
+#define MAX_THREADS 64
+
+void input(char *file_name, int threads);
+#ifdef _WIN32
+DWORD WINAPI run_chunk(LPVOID chunk);
+#else
+void* run_chunk(void *chunk);
+#endif
+void input_chunk(struct chunk* c);
+uint32_t get_weight(char *at, char *stop, char *line);
+void get_pattern(char *word, int n, char *pattern);
+void add_pattern(struct table* t, char *word, int n, char *pattern, uint32_t weight);
+struct bucket* find_bucket(struct table* t, int n, char *pattern);
+void grow_table(struct table* t);
+uint32_t new_bucket(struct table* t, int n, char *pattern);
+void add_word_to_bucket(struct bucket* b, char *words, uint32_t *weights, size_t n);
+void merge(struct table* into, struct table* from);
+void free_table(struct table* t);
+void* resize(void *p, size_t old_size, size_t size);
+void report(struct timespec *start, int threads);
+void outputDelta();
+char hasWord(struct pattern* p, char *word);
+int loadStore();
+void removeDeltas(int deltas);
 void outputStd();
-void outputFile();
+void outputFile(char *words_file, char *index_file, int segment, char extras);
+FILE* openOutput(char *file_name);
+void closeOutput(FILE *fp, char *file_name);
+char* tempName(char *file_name);
+uint64_t outputPostings(FILE *bf, struct bucket* b, uint64_t *bi);
+uint64_t outputPacked(FILE *kf, struct bucket* b, uint64_t *ki);
+uint64_t outputColumns(FILE *cf, struct bucket* b, uint64_t *ci);
+uint64_t outputSummary(FILE *sf, struct bucket* b, uint64_t *si);
+void writeSectionHeader(FILE *fp, char *magic, uint32_t version, uint64_t sum);
+void putU64(char *b, uint64_t n);
+void putU32(char *b, uint32_t n);
 
 // Set to 1 to include additional debugging output
 #define DEBUG 0
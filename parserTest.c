@@ -15,7 +15,8 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    struct puzzle* puzzle = parse(argv[1]);
+    // No dictionary is needed to check the file
+    struct puzzle* puzzle = parse(argv[1], NULL);
 
     // Print puzzle
     for (int i = 0; i < 26; i++) {
@@ -9,6 +9,11 @@
  * If the mask given includes letters such as "&&####" then all six letter words
  * without repeats with the extra condition that the first letters are "ho" will
  * be returned, including "hoping".
+ *
+ * Dictionaries to search can be given as arguments in the form name=dir, where dir is
+ * the directory of a store made by makeData. A third word after the mask picks the
+ * dictionary to search by its name, otherwise the first is searched. With no arguments
+ * the store in "data" is searched.
  */
 
 #include <stdio.h>
@@ -22,14 +27,34 @@
 
 char loop();
 
+// Dictionary searched when a query does not name one
+struct data_store* first_store;
+
 int main(int argc, char** argv) {
     printf("When prompted, enter a word to define a pattern followed by\n");
     printf("a space and then a second word containing known letters. This\n");
     printf("must be the same length and have a '#' where the letter in\n");
     printf("that position is irrelevant and '&' when the letter must match\n");
     printf("the one given. There is a maximum length of 100 characters\n");
+    printf("A third word can name the dictionary to search\n");
+
+    for (int i = 1; i < argc; i++) {
+        char *dir = strchr(argv[i], '=');
+        if (!dir) {
+            printf("Dictionaries must be given as name=dir, not '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        *dir++ = '\0';
 
-    init();
+        struct data_store* ds = loadDictionary(argv[i], dir);
+        if (!first_store) {
+            first_store = ds;
+        }
+    }
+
+    if (!first_store) {
+        first_store = init();
+    }
 
     while (1) {
         if (loop()) {
@@ -85,6 +110,17 @@ char loop() {
         return 0;
     }
 
+    // Pick the dictionary
+    struct data_store* store = first_store;
+    char *dictionary = strtok(NULL, " ");
+    if (dictionary) {
+        store = findDictionary(dictionary);
+        if (!store) {
+            printf("No dictionary named '%s'\n", dictionary);
+            return 0;
+        }
+    }
+
     if (strlen(pattern_string) != strlen(mask_string)) {
         printf("Strings must be the same length\n");
         return 0;
@@ -105,7 +141,7 @@ char loop() {
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < n; i++) {
+    for (size_t i = 0; i < n; i++) {
         if (mask_string[i] == '#') {
             known[i] = 0;
         } else if (mask_string[i] == '&') {
@@ -118,17 +154,17 @@ char loop() {
 
     // Print the pattern that was observed and scan the word list for entries matching it
 
-    for (int i = 0; i < n; i++) {
+    for (size_t i = 0; i < n; i++) {
         printf("%d ", pattern[i]);
     }
     printf("\n");
 
-    newPattern(n, pattern, known);
+    newPattern(store, n, pattern, known);
 
     char* next;
     while (next = nextWord()) {
         printf("\t");
-        for (int i = 0; i < n; i++) {
+        for (size_t i = 0; i < n; i++) {
             printf("%c", *(next + i));
         }
         printf("\n");
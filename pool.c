@@ -0,0 +1,328 @@
+/**
+ * This module shares work out between threads. A pool is made with newPool, and startPool
+ * starts its other threads, each running the function it was given with its number.
+ * Every thread has a deque of jobs: it adds the jobs it makes to the tail with pushJob
+ * and takes back the newest with popJob, while a thread with nothing to do waits in
+ * takeJob for a job, taking the oldest job of another thread's deque. The oldest jobs
+ * were made nearest the start of the work, so are usually the largest.
+ *
+ * The pool counts the jobs not yet finished, and takeJob gives NULL once none are left or
+ * the pool has been stopped. Jobs are only data to the pool, freed with free if the pool
+ * is freed before they are taken.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+// Shorthand for the locks on each system
+#ifdef _WIN32
+#define initMutex(m) InitializeCriticalSection(m)
+#define lockMutex(m) EnterCriticalSection(m)
+#define unlockMutex(m) LeaveCriticalSection(m)
+#define freeMutex(m) DeleteCriticalSection(m)
+#define initCond(c) InitializeConditionVariable(c)
+#define waitCond(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define wakeAll(c) WakeAllConditionVariable(c)
+#define freeCond(c)
+#else
+#define initMutex(m) pthread_mutex_init(m, NULL)
+#define lockMutex(m) pthread_mutex_lock(m)
+#define unlockMutex(m) pthread_mutex_unlock(m)
+#define freeMutex(m) pthread_mutex_destroy(m)
+#define initCond(c) pthread_cond_init(c, NULL)
+#define waitCond(c, m) pthread_cond_wait(c, m)
+#define wakeAll(c) pthread_cond_broadcast(c)
+#define freeCond(c) pthread_cond_destroy(c)
+#endif
+
+/**
+ * @brief Make a pool, whose threads are started by startPool. The calling thread is
+ * thread 0 and already has work, which it finishes with finishJob
+ * @param num_threads number of threads including the calling thread, 1 to MAX_POOL_THREADS
+ * @param run function each other thread runs with its number, which should take jobs
+ * until takeJob gives NULL
+ * @return struct pool* the pool, to be joined with joinPool and freed with freePool
+ */
+struct pool* newPool(int num_threads, void (*run)(int worker)) {
+    struct pool* p = calloc(1, sizeof(struct pool));
+    if (!p) {
+        perror("Failed to allocate pool");
+        exit(EXIT_FAILURE);
+    }
+
+    p->num_threads = num_threads;
+    p->run = run;
+    p->deques = calloc(num_threads, sizeof(struct deque));
+    p->threads = calloc(num_threads, sizeof(pool_thread));
+    p->starts = calloc(num_threads, sizeof(struct pool_start));
+    if (!p->deques || !p->threads || !p->starts) {
+        perror("Failed to allocate pool");
+        exit(EXIT_FAILURE);
+    }
+
+    initMutex(&(p->lock));
+    initCond(&(p->wake));
+    for (int i = 0; i < num_threads; i++) {
+        initMutex(&(p->deques[i].lock));
+    }
+
+    atomic_init(&(p->queued), 0);
+    atomic_init(&(p->idle), 0);
+    atomic_init(&(p->unfinished), 1);
+    atomic_init(&(p->stopped), 0);
+    atomic_init(&(p->made), 0);
+    atomic_init(&(p->stolen), 0);
+
+    return p;
+}
+
+/**
+ * @brief Start the threads of a pool other than the calling thread
+ */
+void startPool(struct pool* p) {
+    for (int i = 1; i < p->num_threads; i++) {
+        p->starts[i].pool = p;
+        p->starts[i].worker = i;
+
+        #ifdef _WIN32
+        p->threads[i] = CreateThread(NULL, 0, startWorker, p->starts + i, 0, NULL);
+        if (!p->threads[i]) {
+            printf("Failed to start thread\n");
+            exit(EXIT_FAILURE);
+        }
+        #else
+        if (pthread_create(p->threads + i, NULL, startWorker, p->starts + i) != 0) {
+            perror("Failed to start thread");
+            exit(EXIT_FAILURE);
+        }
+        #endif
+    }
+}
+
+/**
+ * @brief Add a job to the tail of a thread's deque, waking a thread waiting for one
+ * @param worker number of the thread making the job
+ * @param data the job, allocated with malloc
+ * @param frame number the thread gives the work that made the job, to take it back with
+ */
+void pushJob(struct pool* p, int worker, void *data, int frame) {
+    struct deque* d = p->deques + worker;
+
+    // Counted first, so the job cannot be finished by another thread before it is counted
+    atomic_fetch_add(&(p->made), 1);
+    atomic_fetch_add(&(p->unfinished), 1);
+    atomic_fetch_add(&(p->queued), 1);
+
+    lockMutex(&(d->lock));
+    if (d->head == d->tail) {
+        d->head = 0;
+        d->tail = 0;
+    }
+    if (d->tail == d->size) {
+        d->size = d->size ? d->size * 2 : 64;
+        d->jobs = realloc(d->jobs, d->size * sizeof(struct job));
+        if (!d->jobs) {
+            perror("Failed to allocate jobs");
+            exit(EXIT_FAILURE);
+        }
+    }
+    d->jobs[d->tail].data = data;
+    d->jobs[d->tail].frame = frame;
+    d->tail++;
+    unlockMutex(&(d->lock));
+
+    // A thread that is about to wait has already counted itself as idle, so either sees
+    // the job or is woken
+    if (atomic_load(&(p->idle))) {
+        lockMutex(&(p->lock));
+        wakeAll(&(p->wake));
+        unlockMutex(&(p->lock));
+    }
+}
+
+/**
+ * @brief Take back the newest job of a thread's deque, if it was made by the given frame
+ * and no other thread has taken it. Once the job is done, finishJob must be called
+ * @param worker number of the thread that made the job
+ * @param frame number the thread gave the work that made the job
+ * @return void* the job, or NULL if there is none or the pool has been stopped
+ */
+void* popJob(struct pool* p, int worker, int frame) {
+    if (atomic_load(&(p->stopped))) {
+        return NULL;
+    }
+
+    struct deque* d = p->deques + worker;
+    void *data = NULL;
+
+    lockMutex(&(d->lock));
+    if (d->tail > d->head && d->jobs[d->tail - 1].frame == frame) {
+        data = d->jobs[--d->tail].data;
+        atomic_fetch_sub(&(p->queued), 1);
+    }
+    unlockMutex(&(d->lock));
+
+    return data;
+}
+
+/**
+ * @brief Take a job for a thread with no work: the newest of its own, otherwise the oldest
+ * of another thread's, waiting until there is one. Once the job is done, finishJob must
+ * be called
+ * @param worker number of the thread taking the job
+ * @return void* the job, or NULL when every job is finished or the pool has been stopped
+ */
+void* takeJob(struct pool* p, int worker) {
+    while (!atomic_load(&(p->stopped))) {
+        void *data = takeFrom(p, p->deques + worker, 1);
+        for (int k = 1; !data && k < p->num_threads; k++) {
+            data = takeFrom(p, p->deques + (worker + k) % p->num_threads, 0);
+            if (data) {
+                atomic_fetch_add(&(p->stolen), 1);
+            }
+        }
+
+        if (data) {
+            return data;
+        }
+
+        lockMutex(&(p->lock));
+        atomic_fetch_add(&(p->idle), 1);
+        while (!atomic_load(&(p->queued)) && atomic_load(&(p->unfinished)) && !atomic_load(&(p->stopped))) {
+            waitCond(&(p->wake), &(p->lock));
+        }
+        atomic_fetch_sub(&(p->idle), 1);
+
+        char done = !atomic_load(&(p->queued)) && !atomic_load(&(p->unfinished));
+        unlockMutex(&(p->lock));
+
+        if (done) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Take a job from a deque
+ * @param d the deque
+ * @param newest 1 for the job at the tail, 0 for the job at the head
+ * @return void* the job, or NULL if the deque is empty
+ */
+void* takeFrom(struct pool* p, struct deque* d, char newest) {
+    void *data = NULL;
+
+    lockMutex(&(d->lock));
+    if (d->tail > d->head) {
+        data = newest ? d->jobs[--d->tail].data : d->jobs[d->head++].data;
+        atomic_fetch_sub(&(p->queued), 1);
+    }
+    unlockMutex(&(d->lock));
+
+    return data;
+}
+
+/**
+ * @brief Count a job, or the first thread's starting work, as finished. Threads waiting
+ * for jobs are woken once every job is
+ */
+void finishJob(struct pool* p) {
+    if (atomic_fetch_sub(&(p->unfinished), 1) == 1) {
+        lockMutex(&(p->lock));
+        wakeAll(&(p->wake));
+        unlockMutex(&(p->lock));
+    }
+}
+
+/**
+ * @brief Stop the pool, so no more jobs are given out. Jobs already taken carry on until
+ * their threads check poolStopped
+ */
+void stopPool(struct pool* p) {
+    atomic_store(&(p->stopped), 1);
+
+    lockMutex(&(p->lock));
+    wakeAll(&(p->wake));
+    unlockMutex(&(p->lock));
+}
+
+/**
+ * @brief Check whether the pool has been stopped
+ */
+char poolStopped(struct pool* p) {
+    return atomic_load(&(p->stopped));
+}
+
+/**
+ * @brief Lock the pool, for results the threads share
+ */
+void lockPool(struct pool* p) {
+    lockMutex(&(p->lock));
+}
+
+/**
+ * @brief Unlock the pool after lockPool
+ */
+void unlockPool(struct pool* p) {
+    unlockMutex(&(p->lock));
+}
+
+/**
+ * @brief Wait for the threads the pool started to return
+ */
+void joinPool(struct pool* p) {
+    for (int i = 1; i < p->num_threads; i++) {
+        #ifdef _WIN32
+        WaitForSingleObject(p->threads[i], INFINITE);
+        CloseHandle(p->threads[i]);
+        #else
+        pthread_join(p->threads[i], NULL);
+        #endif
+    }
+}
+
+/**
+ * @brief Free a joined pool and any jobs left in it
+ */
+void freePool(struct pool* p) {
+    if (!p) {
+        return;
+    }
+
+    for (int i = 0; i < p->num_threads; i++) {
+        struct deque* d = p->deques + i;
+        for (int j = d->head; j < d->tail; j++) {
+            free(d->jobs[j].data);
+        }
+        free(d->jobs);
+        freeMutex(&(d->lock));
+    }
+
+    freeMutex(&(p->lock));
+    freeCond(&(p->wake));
+
+    free(p->deques);
+    free(p->threads);
+    free(p->starts);
+    free(p);
+}
+
+/**
+ * @brief Thread entry point for the threads a pool starts
+ */
+#ifdef _WIN32
+DWORD WINAPI startWorker(LPVOID start) {
+    struct pool_start* s = start;
+    s->pool->run(s->worker);
+    return 0;
+}
+#else
+void* startWorker(void *start) {
+    struct pool_start* s = start;
+    s->pool->run(s->worker);
+    return NULL;
+}
+#endif
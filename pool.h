@@ -0,0 +1,87 @@
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION pool_mutex;
+typedef CONDITION_VARIABLE pool_cond;
+typedef HANDLE pool_thread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t pool_mutex;
+typedef pthread_cond_t pool_cond;
+typedef pthread_t pool_thread;
+#endif
+
+// Most threads a pool can be made with
+#define MAX_POOL_THREADS 64
+
+// A piece of work waiting in a deque, and the frame of the work that made it
+struct job {
+    void *data;
+    int frame;
+};
+
+// Jobs made by one thread, oldest at head. The thread adds and takes back jobs at the
+// tail, other threads take them from the head
+struct deque {
+    pool_mutex lock;
+    struct job *jobs;
+    int head;
+    int tail;
+    int size;
+};
+
+// What a thread started by a pool is given
+struct pool_start {
+    struct pool *pool;
+    int worker;
+};
+
+// Threads sharing out jobs. Thread 0 is the one that made the pool
+struct pool {
+    int num_threads;
+    struct deque *deques;
+    pool_thread *threads;
+    struct pool_start *starts;
+    void (*run)(int worker);
+
+    // Held while waiting for jobs, and by users of the pool for results they share
+    pool_mutex lock;
+    pool_cond wake;
+
+    // Jobs in the deques, threads waiting for jobs and jobs made but not finished. The
+    // work the first thread starts with counts as a job
+    atomic_int queued;
+    atomic_int idle;
+    atomic_int unfinished;
+    atomic_int stopped;
+
+    // Number of jobs made and the number of those taken by another thread
+    atomic_ullong made;
+    atomic_ullong stolen;
+};
+
+struct pool* newPool(int num_threads, void (*run)(int worker));
+void startPool(struct pool* p);
+void pushJob(struct pool* p, int worker, void *data, int frame);
+void* popJob(struct pool* p, int worker, int frame);
+void* takeJob(struct pool* p, int worker);
+void* takeFrom(struct pool* p, struct deque* d, char newest);
+void finishJob(struct pool* p);
+void stopPool(struct pool* p);
+char poolStopped(struct pool* p);
+void lockPool(struct pool* p);
+void unlockPool(struct pool* p);
+void joinPool(struct pool* p);
+void freePool(struct pool* p);
+#ifdef _WIN32
+DWORD WINAPI startWorker(LPVOID start);
+#else
+void* startWorker(void *start);
+#endif
+
+#endif
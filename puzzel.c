@@ -1,6 +1,8 @@
 
 /**
- * This module is responsible for parsing a puzzle file into a data structure
+ * This module is responsible for parsing a puzzle file into a data structure.
+ * A puzzle is solved against one dictionary, given when it is parsed, so that each code
+ * word's pattern can be matched to its bucket of words while parsing
  */
 
 #include <stdio.h>
@@ -16,9 +18,10 @@ struct cwrd_node {
 };
 
 /**
- * Open the file name 'filename' and parse the file as a puzzle.
+ * Open the file name 'filename' and parse the file as a puzzle to be solved against the
+ * dictionary 'store'. With no dictionary (NULL) no code word has any words.
  */
-struct puzzle* parse(char *filename) {
+struct puzzle* parse(char *filename, struct data_store* store) {
     // Open puzzle file
     FILE *fp = fopen(filename, "r");
     if (!fp) {
@@ -33,6 +36,8 @@ struct puzzle* parse(char *filename) {
         exit(EXIT_FAILURE);
     }
 
+    p->store = store;
+
     // Clear the 'known' field
     if (memset(p->known, 0, 26) != p->known) {
         perror("Failed to clear known");
@@ -49,7 +54,7 @@ struct puzzle* parse(char *filename) {
     int i = 0;
     struct cwrd_node* head = NULL;
     struct cwrd_node* next;
-    while (next = parseWord(fp, head)) {
+    while (next = parseWord(fp, head, store, p->known)) {
         i++;
         head = next;
     }
@@ -76,13 +81,36 @@ struct puzzle* parse(char *filename) {
         exit(EXIT_FAILURE);
     }
 
-    // Fill needed field
+    // Fill needed field, counting the uses of each code letter
+    memset(p->num_uses, 0, sizeof(p->num_uses));
     for (int j = 0; j < i; j++) {
         struct cwrd* cw = p->cwrds[j];
 
         for (int k = 0; k < cw->len; k++) {
             int l = cw->clets[k] - 1;
             p->needed[l] = 1;
+            p->num_uses[l]++;
+        }
+    }
+
+    // List the uses of each code letter
+    for (int l = 0; l < 26; l++) {
+        p->uses[l] = malloc(p->num_uses[l] * sizeof(struct use));
+        if (!p->uses[l] && p->num_uses[l]) {
+            perror("Failed to allocate uses");
+            exit(EXIT_FAILURE);
+        }
+        p->num_uses[l] = 0;
+    }
+
+    for (int j = 0; j < i; j++) {
+        struct cwrd* cw = p->cwrds[j];
+
+        for (int k = 0; k < cw->len; k++) {
+            int l = cw->clets[k] - 1;
+            p->uses[l][p->num_uses[l]].cw = cw;
+            p->uses[l][p->num_uses[l]].pos = k;
+            p->num_uses[l]++;
         }
     }
 
@@ -138,8 +166,10 @@ char parseKnown(FILE *fp, char *known) {
 
 /**
  * @brief Parse a line of input from the file as a codeword
+ * @param known letters known for each code letter so far, which decide what is read of
+ * the code word's bucket in a lazy store
  */
-struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head) {
+struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head, struct data_store* store, char *known) {
     // Read a line
     char line_buffer[100];
     if (fgets(line_buffer, 100, fp) != line_buffer) {
@@ -184,6 +214,10 @@ struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head) {
             printf("Error parsing token '%s' in word %d\n", token, n + 1);
             exit(EXIT_FAILURE);
         }
+        if (i < 1 || i > 26) {
+            printf("Invalid code letter %d at position %d of a code word\n", i, n + 1);
+            exit(EXIT_FAILURE);
+        }
         word_buffer[n] = i;
 
         n++;
@@ -192,6 +226,7 @@ struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head) {
     // Store total length
     node->cwrd->len = n;
     node->cwrd->dirty = 1;
+    node->cwrd->conflicts = 1;
 
     // Allocate string to hold word
     node->cwrd->clets = malloc(n);
@@ -214,17 +249,144 @@ struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head) {
         exit(EXIT_FAILURE);
     }
 
+    node->cwrd->likelihood = calloc(sizeof(double), n * 26);
+    if (!node->cwrd->likelihood) {
+        perror("Failed to allocate likelihood");
+        exit(EXIT_FAILURE);
+    }
+
     node->cwrd->known = calloc(1, n);
     if (!node->cwrd->known) {
         perror("Failed to allocate known");
         exit(EXIT_FAILURE);
     }
 
+    // No words have been read yet
+    node->cwrd->words = NULL;
+    node->cwrd->weights = NULL;
+    node->cwrd->num_words = 0;
+    node->cwrd->words_size = 0;
+    node->cwrd->words_exclude = 0;
+    node->cwrd->words_known = calloc(1, n);
+    if (!node->cwrd->words_known) {
+        perror("Failed to allocate known");
+        exit(EXIT_FAILURE);
+    }
+
     node->cwrd->pattern = generatePattern(node->cwrd->clets, node->cwrd->len);
+    if (!node->cwrd->pattern) {
+        printf("Invalid code word\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Find the words for this pattern now so searches never have to look for them
+    node->cwrd->bucket = findPattern(store, node->cwrd->len, node->cwrd->pattern);
+
+    // Only the buckets of the puzzle's patterns are read from a lazy store, starting now
+    // so reading overlaps with parsing the rest of the puzzle. Summaries are only used
+    // before any letter is known
+    char summary = 1;
+    for (int l = 0; l < 26; l++) {
+        if (known[l]) {
+            summary = 0;
+        }
+    }
+    loadBucket(store, node->cwrd->bucket, summary);
 
     return node;
 }
 
+/**
+ * @brief Make a copy of a puzzle with copies of all its code words, so it can be solved
+ * separately. Lists of words are copied with their letters
+ */
+struct puzzle* copyPuzzle(struct puzzle* from) {
+    struct puzzle* p = malloc(sizeof(struct puzzle));
+    if (!p) {
+        perror("Failed to allocate puzzle");
+        exit(EXIT_FAILURE);
+    }
+    *p = *from;
+
+    int n = 0;
+    while (from->cwrds[n]) {
+        n++;
+    }
+
+    p->cwrds = calloc(sizeof(struct cwrd*), n + 1);
+    if (!p->cwrds) {
+        perror("Failed to allocate cwrds");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int j = 0; j < n; j++) {
+        struct cwrd* f = from->cwrds[j];
+        struct cwrd* cw = malloc(sizeof(struct cwrd));
+        if (!cw) {
+            perror("Failed to allocate cwrd");
+            exit(EXIT_FAILURE);
+        }
+        *cw = *f;
+
+        cw->clets = malloc(cw->len);
+        cw->possible = malloc(cw->len * sizeof(uint32_t));
+        cw->likelihood = malloc(cw->len * 26 * sizeof(double));
+        cw->pattern = malloc(cw->len);
+        cw->known = malloc(cw->len);
+        cw->words_known = malloc(cw->len);
+        if (!cw->clets || !cw->possible || !cw->likelihood || !cw->pattern || !cw->known || !cw->words_known) {
+            perror("Failed to allocate cwrd");
+            exit(EXIT_FAILURE);
+        }
+
+        memcpy(cw->clets, f->clets, cw->len);
+        memcpy(cw->possible, f->possible, cw->len * sizeof(uint32_t));
+        memcpy(cw->likelihood, f->likelihood, cw->len * 26 * sizeof(double));
+        memcpy(cw->pattern, f->pattern, cw->len);
+        memcpy(cw->known, f->known, cw->len);
+        memcpy(cw->words_known, f->words_known, cw->len);
+
+        cw->words = NULL;
+        cw->weights = NULL;
+        if (f->words_size) {
+            cw->words = malloc((size_t) f->words_size * cw->len);
+            cw->weights = malloc(f->words_size * sizeof(uint32_t));
+            if (!cw->words || !cw->weights) {
+                perror("Failed to allocate code word's words");
+                exit(EXIT_FAILURE);
+            }
+
+            memcpy(cw->words, f->words, (size_t) f->num_words * cw->len);
+            memcpy(cw->weights, f->weights, f->num_words * sizeof(uint32_t));
+        }
+
+        p->cwrds[j] = cw;
+    }
+
+    // List the uses of each code letter in the copies, in the same order as parse
+    for (int l = 0; l < 26; l++) {
+        p->uses[l] = malloc(p->num_uses[l] * sizeof(struct use));
+        if (!p->uses[l] && p->num_uses[l]) {
+            perror("Failed to allocate uses");
+            exit(EXIT_FAILURE);
+        }
+        p->num_uses[l] = 0;
+    }
+
+    for (int j = 0; j < n; j++) {
+        struct cwrd* cw = p->cwrds[j];
+
+        for (int k = 0; k < cw->len; k++) {
+            int l = cw->clets[k] - 1;
+            p->uses[l][p->num_uses[l]].cw = cw;
+            p->uses[l][p->num_uses[l]].pos = k;
+            p->num_uses[l]++;
+        }
+    }
+
+    return p;
+}
+
 /**
  * @brief Method for freeing the memory belonging to a puzzle
  */
@@ -235,14 +397,22 @@ void freePuzzle(struct puzzle* p) {
 
         free(cw->clets);
         free(cw->possible);
+        free(cw->likelihood);
         free(cw->pattern);
         free(cw->known);
+        free(cw->words);
+        free(cw->weights);
+        free(cw->words_known);
 
         free(cw);
 
         cws++;
     }
 
+    for (int l = 0; l < 26; l++) {
+        free(p->uses[l]);
+    }
+
     free(p->cwrds);
     free(p);
 }
@@ -5,26 +5,56 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+struct data_store;
+
 // Code word structure
 struct cwrd {
     int len; // number of code letters
     char* clets; // ref to code letter array
     uint32_t* possible;
+    double* likelihood; // log share of the matching words' weight for each letter, 26 per position
+    double best; // log weight of the heaviest matching word
     char dirty; // Set to 1 if any number has been solved (pattern changed)
+    uint32_t used; // letters already used when the possibilities were collected
 
     char* pattern; // reprentation of the pattern for this code word
     char* known; // pattern but without any filled in values
+    int bucket; // bucket of words matching the pattern, negative when there are none
+    int conflicts; // one more than the times a code letter of this word was left with no letters
+
+    // Letters of the words that may still match, len for each word one after another, and
+    // their weights. They are the words with the letters in words_known that have none of
+    // the letters in words_exclude, so the words for more known or more ruled out letters
+    // can be picked out of them. NULL until the words are first read
+    char* words;
+    uint32_t* weights;
+    uint32_t num_words;
+    uint32_t words_size;
+    char* words_known;
+    uint32_t words_exclude;
+};
+
+// A place a code letter is used: a code word and the position in it
+struct use {
+    struct cwrd* cw;
+    int pos;
 };
 
 struct puzzle {
+    struct data_store* store; // dictionary the puzzle is solved against
     struct cwrd** cwrds;
     char known[26];
     char needed[26];
+
+    // Places each code letter is used, in the order of the code words then positions
+    struct use* uses[26];
+    int num_uses[26];
 };
 
-struct puzzle* parse(char *filename);
+struct puzzle* parse(char *filename, struct data_store* store);
 char parseKnown(FILE *fp, char *known);
-struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head);
+struct cwrd_node* parseWord(FILE *fp, struct cwrd_node* head, struct data_store* store, char *known);
+struct puzzle* copyPuzzle(struct puzzle* from);
 void freePuzzle(struct puzzle* p);
 
 #endif
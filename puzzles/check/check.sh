@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Checks the solver against the puzzles in this directory, whose solution counts are given
+# in the file counts, one "name count" per line. Run from the top of the repository after
+# building (make check does both).
+#
+# The dictionary words.txt is made into a store in check/data, and again with --packed and
+# --columns in check/packed. For each puzzle this checks that:
+# - countTest, which counts by trying every word, finds the expected count;
+# - solver --count finds it with one thread, with four threads and with the packed store;
+# - every solution printed by --all and --rank decodes each code word to a word of the
+#   dictionary, using each letter once (keys.awk), and there are as many as expected;
+# - --unique and the search for the first solution report what the count says they should.
+
+dir=puzzles/check
+failed=0
+
+fail() {
+    echo "FAIL $name: $1"
+    failed=1
+}
+
+# Number printed by the solver after the given text, or none if it was not printed
+found() {
+    sed -n "s/^$1\([0-9]*\).*/\1/p" "$dir/out.txt" | head -n 1
+}
+
+mkdir -p "$dir/data" "$dir/packed"
+./makeData "$dir/words.txt" -o "$dir/data" > /dev/null || exit 1
+./makeData "$dir/words.txt" -o "$dir/packed" --packed --columns > /dev/null || exit 1
+
+while read name count; do
+    pzl="$dir/$name.pzl"
+
+    ./countTest "$pzl" "$dir/data" > "$dir/out.txt"
+    [ "$(found "Solutions found: ")" = "$count" ] || fail "countTest found $(found "Solutions found: ")"
+
+    for args in "--dict $dir/data" "--dict $dir/data --threads 4" "--dict $dir/packed"; do
+        ./solver "$pzl" $args --count > "$dir/out.txt"
+        [ "$(found "Solutions found: ")" = "$count" ] || fail "$args --count found $(found "Solutions found: ")"
+    done
+
+    ./solver "$pzl" --dict "$dir/data" --all > "$dir/out.txt"
+    keys=$(awk -f "$dir/keys.awk" "$dir/words.txt" "$pzl" "$dir/out.txt") || fail "--all printed a bad solution"
+    [ "$(echo "$keys" | tail -n 1)" = "$count" ] || fail "--all printed $(echo "$keys" | tail -n 1) solutions"
+
+    ranked=$(( count < 3 ? count : 3 ))
+    ./solver "$pzl" --dict "$dir/data" --rank 3 > "$dir/out.txt"
+    keys=$(awk -f "$dir/keys.awk" "$dir/words.txt" "$pzl" "$dir/out.txt") || fail "--rank printed a bad solution"
+    [ "$(echo "$keys" | tail -n 1)" = "$ranked" ] || fail "--rank 3 ranked $(echo "$keys" | tail -n 1) solutions"
+
+    case $count in
+        0) unique="No solution found" ;;
+        1) unique="Solution is unique" ;;
+        *) unique="Solution is not unique" ;;
+    esac
+    ./solver "$pzl" --dict "$dir/data" --unique > "$dir/out.txt"
+    grep -q "^$unique" "$dir/out.txt" || fail "--unique did not report \"$unique\""
+
+    [ "$count" = 0 ] && solved="Puzzle Not Solved" || solved="Puzzle Solved"
+    ./solver "$pzl" --dict "$dir/data" > "$dir/out.txt"
+    grep -q "^$solved" "$dir/out.txt" || fail "the first solution search did not report \"$solved\""
+
+    echo "$name: $count solutions"
+done < "$dir/counts"
+
+rm -f "$dir/out.txt"
+
+if [ "$failed" = 1 ]; then
+    echo "Check failed"
+    exit 1
+fi
+echo "All puzzles passed"
@@ -0,0 +1,83 @@
+# Checks the solutions the solver printed for a puzzle.
+#
+# Usage: awk -f keys.awk <dictionary> <puzzle_file> <solver_output>
+#
+# Reads each key printed by --all ("Solution n: key") or --rank ("n. key (log weight w)"),
+# a key being 26 letters with '.' for unused code letters. A key is bad if it does not
+# agree with the puzzle's known letters, gives two code letters the same letter, leaves a
+# code letter of the puzzle without one, decodes a code word to a word not in the
+# dictionary or was already printed. Prints the number of keys and exits with 1 if any
+# key is bad.
+
+FILENAME == ARGV[1] {
+    words[$1] = 1
+    next
+}
+
+FILENAME == ARGV[2] {
+    if ($0 == "") {
+        in_words = 1
+    } else if (!in_words) {
+        known[$1] = $2
+    } else {
+        cwrds[++num_cwrds] = $0
+    }
+    next
+}
+
+/^Solution [0-9]+: / || /^ +[0-9]+\. [a-z.]+ \(log weight/ {
+    key = /^Solution/ ? $3 : $2
+    num_keys++
+
+    if (length(key) != 26) {
+        bad("is not 26 letters long")
+    } else if (key in seen) {
+        bad("was already found")
+    } else {
+        seen[key] = 1
+        check(key)
+    }
+}
+
+END {
+    print num_keys + 0
+    exit failed
+}
+
+function bad(reason) {
+    print "Solution " key " " reason
+    failed = 1
+}
+
+function check(key,    c, letter, used, i, n, clets, word) {
+    for (c in known) {
+        if (substr(key, c, 1) != known[c]) {
+            bad("does not keep " c " -> " known[c])
+            return
+        }
+    }
+
+    for (c = 1; c <= 26; c++) {
+        letter = substr(key, c, 1)
+        if (letter == ".") {
+            continue
+        }
+        if (letter in used) {
+            bad("gives " letter " to code letters " used[letter] " and " c)
+            return
+        }
+        used[letter] = c
+    }
+
+    for (i = 1; i <= num_cwrds; i++) {
+        n = split(cwrds[i], clets, " ")
+        word = ""
+        for (c = 1; c <= n; c++) {
+            word = word substr(key, clets[c], 1)
+        }
+        if (!(word in words)) {
+            bad("decodes " cwrds[i] " to " word)
+            return
+        }
+    }
+}
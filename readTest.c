@@ -1,37 +1,170 @@
 /**
- * Test file for word list, reads the data stored in directory "data" created using
- * makeData. It will output the data in the same form as output by adding flag
+ * Test file for word list, reads the data stored in directory "data" (or the directory
+ * given as the first argument) created using makeData. It will output the data in the same form as output by adding flag
  * 'test' to makeData. Both output to stdout.
+ *
+ * The format of the store is reported first. For version 2 stores the checksum is
+ * recalculated and compared with the one stored in the index, as it is for each delta
+ * segment, and any packed words, columns or summaries are compared with the words file.
+ * A store without a words file has its checksum worked out from the packed words, and
+ * the columns and summaries are compared with those.
  */
 
 #include "dataStore.h"
 
 int main(int argc, char **argv) {
-    struct data_store* ds = read();
+    struct data_store* ds = argc > 1 ? readStore(argv[1]) : read();
 
+    if (ds->version == 1) {
+        printf("Format: version 1 (unversioned)\n");
+    } else {
+        printf("Format: version %u%s\n", ds->version, ds->packed_only ? ", packed words" : "");
+
+        uint64_t sum = storeChecksum(ds);
+        if (sum != ds->checksum) {
+            printf("Checksum mismatch: stored %016" PRIx64 " calculated %016" PRIx64 "\n", ds->checksum, sum);
+            freeDataStore(ds);
+            return 1;
+        }
+        printf("Checksum: %016" PRIx64 " (ok)\n", sum);
+    }
+
+    // Each delta segment has a checksum of its own
+    int k = 1;
+    for (struct data_store* delta = ds->delta; delta; delta = delta->delta, k++) {
+        uint64_t sum = storeChecksum(delta);
+        if (sum != delta->checksum) {
+            printf("Checksum mismatch in delta segment %d: stored %016" PRIx64 " calculated %016" PRIx64 "\n",
+                k, delta->checksum, sum);
+            freeDataStore(ds);
+            return 1;
+        }
+        printf("Delta segment %d: %" PRIu64 " words, checksum %016" PRIx64 " (ok)\n", k, delta->num_words, sum);
+    }
+
+    printf("Number of words: %" PRIu64 "\n", ds->num_words);
     printf("Number of patterns: %d\n", ds->num_patterns);
 
+    if (ds->postings) {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < ds->num_patterns; i++) {
+            if (ds->patterns[i].postings) n++;
+        }
+        printf("Patterns with postings: %u\n", n);
+    }
+
+    // The packed words must hold the same letters as the words file, if there is one
+    if (ds->packed && !ds->packed_only) {
+        for (uint32_t i = 0; i < ds->num_patterns; i++) {
+            struct pattern *p = ds->patterns + i;
+            if (!p->packed) {
+                continue;
+            }
+
+            uint64_t bit = 0;
+            for (char *c = p->start; c < p->end; c++, bit += PACKED_BITS) {
+                uint64_t bits = p->packed[bit / 64] >> (bit % 64);
+                if (bit % 64 > 64 - PACKED_BITS) {
+                    bits |= p->packed[bit / 64 + 1] << (64 - bit % 64);
+                }
+
+                if ('a' + (bits & 31) != (unsigned char) *c) {
+                    printf("Packed words differ from the words file in pattern %u\n", i);
+                    freeDataStore(ds);
+                    return 1;
+                }
+            }
+        }
+        printf("Packed words: ok\n");
+    }
+
+    // So must the columns, letter by letter
+    if (ds->columns) {
+        for (uint32_t i = 0; i < ds->num_patterns; i++) {
+            struct pattern *p = ds->patterns + i;
+            if (!p->columns) {
+                continue;
+            }
+
+            uint64_t num = (p->end - p->start) / p->len;
+            char letters[p->len];
+            for (uint64_t w = 0; w < num; w++) {
+                char *word = patternWord(p, w, letters);
+                for (int j = 0; j < p->len; j++) {
+                    if (p->columns[j * num + w] != word[j]) {
+                        printf("Columns differ from the words file in pattern %u\n", i);
+                        freeDataStore(ds);
+                        return 1;
+                    }
+                }
+            }
+        }
+        printf("Columns: ok\n");
+    }
+
+    // Summaries must add up to the words' letters and weights
+    if (ds->summary) {
+        for (uint32_t i = 0; i < ds->num_patterns; i++) {
+            struct pattern *p = ds->patterns + i;
+            if (!p->summary) {
+                continue;
+            }
+
+            uint64_t num = (p->end - p->start) / p->len;
+            uint64_t *weights = p->summary + 2;
+            uint32_t *letters = (uint32_t *) (weights + p->len * 26);
+            uint64_t total = 0;
+            for (uint64_t w = 0; w < num; w++) {
+                total += p->weights ? p->weights[w] : 1;
+            }
+            char ok = total == p->summary[0];
+
+            char word[p->len];
+            for (int j = 0; j < p->len; j++) {
+                uint32_t set = 0;
+                uint64_t sum = 0;
+                for (uint64_t w = 0; w < num; w++) {
+                    set |= 0x1 << (patternWord(p, w, word)[j] - 'a');
+                }
+                for (int l = 0; l < 26; l++) {
+                    sum += weights[j * 26 + l];
+                }
+                ok &= set == letters[j] && sum == total;
+            }
+
+            if (!ok) {
+                printf("Summary differs from the words file in pattern %u\n", i);
+                freeDataStore(ds);
+                return 1;
+            }
+        }
+        printf("Summary: ok\n");
+    }
+
     for (uint32_t i = 0; i < ds->num_patterns; i++) {
         struct pattern *p = ds->patterns + i;
 
         printf("'");
-        for (char j = 0; j < p->len; j++) {
+        for (int j = 0; j < p->len; j++) {
             printf("%d ", *(p->pattern + j));
         }
         printf("'\n");
 
-        char *start = p->start;
-
-        while (start < p->end) {
-            printf("\t");
+        // Words in the base store then those added by each delta segment
+        char letters[p->len];
+        for (struct pattern *seg = p; seg; seg = seg->next) {
+            uint64_t num = (seg->end - seg->start) / p->len;
 
-            for (char j = 0; j < p->len; j++) {
-                printf("%c", *(start + j));
-            }
+            for (uint64_t w = 0; w < num; w++) {
+                char *word = patternWord(seg, w, letters);
+                printf("\t");
 
-            printf("\n");
+                for (int j = 0; j < p->len; j++) {
+                    printf("%c", word[j]);
+                }
 
-            start += p->len;
+                printf("\n");
+            }
         }
     }
 
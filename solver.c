@@ -1,8 +1,13 @@
 
 #include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "puzzel.h"
 #include "data.h"
+#include "cache.h"
+#include "pool.h"
 
 /**
  * @brief Full set of letters.
@@ -11,14 +16,115 @@
  */
 #define FULL_SET 0x3FFFFFF
 
+// A code word's list of words is only kept when it has at most this fraction of the words
+// of a bucket with postings
+#define WORDS_FRACTION 8
+
+// Largest number of code letters sharing the same letters looked for by propagate
+#define NAKED_MAX 3
+
+// Ways of finding every solution rather than stopping at the first: printing each one,
+// counting them, or only finding out whether there is exactly one
+#define ENUMERATE_ALL 1
+#define ENUMERATE_COUNT 2
+#define ENUMERATE_UNIQUE 3
+
 char solve();
 void collatePossibilities();
 void collect(struct cwrd* cw);
+void collectGroup(struct cwrd** group, int n);
+char collectSummary(struct cwrd* cw);
+size_t collectKey(struct cwrd* cw, char *key);
+char recall(struct cwrd* cw);
+void remember(struct cwrd* cw);
+uint32_t excluded(struct cwrd* cw);
+char narrow(struct cwrd* cw);
+void startWords(struct cwrd* cw);
+char keepWord(struct cwrd* cw, char *word, uint32_t weight);
+uint32_t wordsLimit(struct cwrd* cw);
+struct change* newChange();
+void setKnown(int i, char c);
+void saveCwrd(struct cwrd* cw);
+void undo(int mark);
+char stale(struct cwrd* cw);
+void prepareCollect(struct cwrd* cw);
+void addWord(struct cwrd* cw, char *word, double weight);
+void finishCollect(struct cwrd* cw, double total, double best);
+char propagate();
+int nakedSubset(int *in, int k, int *clets, int num);
 int findSolutions(char *solutions, int *guessable, int *guessable_num);
 char noSolutions(int guessable_num, int guessable);
+char tryGuess(int clet, char c, int mark, double space);
+char shareGuesses(char *order, int n, int guessable, double space);
+void blame(int clet);
+double searchSpace();
+void noteImpact(int clet, double before, double after);
+double scoreDom(int clet, int n);
+double scoreDomWdeg(int clet, int n);
+double scoreDomDeg(int clet, int n);
+double scoreImpact(int clet, int n);
+void runWorker(int id);
+void searchJobs();
+void keepSolution();
+char outranked();
 char recurse(char *solutions);
 int count(uint32_t p);
 void markDirty(int i);
+void addDirty(struct cwrd* cw);
+void outdate(struct cwrd* cw);
+void rankSolution(double score);
+double solutionScore();
+double bestScore();
+char reportRanked();
+char countSolution();
+char reportSolutions();
+
+// A full solution found in rank mode and the sum of the log weights of its words
+struct ranked {
+    double score;
+    char known[26];
+};
+
+// A rule for choosing the code letter to guess. Each code letter with more than one
+// possible letter is given a score from the number it has, and the lowest is guessed,
+// the first code letter on a tie
+struct heuristic {
+    char *name;
+    double (*score)(int clet, int n);
+};
+
+// A guess for another thread to try: the letters known when it was made and the letter
+// guessed for a code letter
+struct guess {
+    char known[26];
+    int clet;
+    char letter;
+};
+
+// A change to the state of the search, undone when the guess that led to it fails. It
+// is either the letter a code letter was known as (cw NULL), or the state a code word had
+// before it was marked dirty (known NULL) or collected again
+struct change {
+    struct cwrd* cw;
+
+    // Code letter and the letter it was known as
+    int clet;
+    char letter;
+
+    // Code word's state. Its arrays belong to the change until it is undone
+    char dirty;
+    uint32_t used;
+    double best;
+    char* known;
+    uint32_t* possible;
+    double* likelihood;
+    char* words;
+    uint32_t* weights;
+    uint32_t num_words;
+    uint32_t words_size;
+    char* words_known;
+    uint32_t words_exclude;
+};
 
 // Set to 1 and recompile for the most debugging information
 #define DEBUG 0
@@ -47,24 +153,139 @@ void markDirty(int i);
 /**
  * @brief The list of possibilities
  * Note that a possibility is a 32-bit vector representing a sub-set of the alphabet.
- * The least significant bit represents 'a', so 'z' is accessed by ((0x1 << 25) & v)
+ * The least significant bit represents 'a', so 'z' is accessed by ((0x1 << 25) & v).
+ * Like the rest of the state of the search, each thread searching has its own
+ */
+_Thread_local uint32_t possible[26];
+
+/**
+ * @brief The letters that fit every code word using each code letter, before the letters
+ * already used are removed. Only the code letters in outdated need working out again
  */
-uint32_t possible[26];
+_Thread_local uint32_t matching[26];
+_Thread_local uint32_t outdated = FULL_SET;
+
+/**
+ * @brief How likely each letter is for each code letter, as the sum over the code letter's
+ * uses of the log of the share of the matching words' weight with that letter there.
+ * Guesses try the most likely letters first
+ */
+_Thread_local double likelihood[26][26];
 
 /**
  * @brief The set of letters that have already been used in the puzzle
  */
-uint32_t used = 0;
+_Thread_local uint32_t used = 0;
 
 /**
  * @brief The puzzle we are currently trying to solve
  */
-struct puzzle* puzzle;
+_Thread_local struct puzzle* puzzle;
+
+/**
+ * @brief Cursor reading the words of the puzzle's dictionary
+ */
+_Thread_local struct cursor* reader = NULL;
 
 /**
  * @brief The current depth of recursion (only used when VERBOSE is set to 1)
  */
-int depth = 0;
+_Thread_local int depth = 0;
+
+/**
+ * @brief Number of solutions to find in rank mode, 0 to stop at the first solution.
+ * The best found so far are kept in ranked, most likely first
+ */
+int rank_size = 0;
+struct ranked* ranked;
+int num_ranked = 0;
+int num_found = 0;
+
+/**
+ * @brief How every solution is found, one of the ENUMERATE values, or 0 to stop at the
+ * first solution. The solutions found are counted in num_solutions and the first is kept
+ * in solution
+ */
+char enumerate = 0;
+uint64_t num_solutions = 0;
+
+/**
+ * @brief Possible letters collected for code words, kept so that a code word asked for
+ * again with the same known letters does not need its words reading again. Results are
+ * kept for any puzzle and dictionary. NULL when not in use
+ */
+_Thread_local struct cache* collected = NULL;
+int cache_size = CACHE_DEFAULT_SIZE;
+uint64_t cache_hits = 0;
+uint64_t cache_misses = 0;
+
+/**
+ * @brief Changes made to the state of the search, most recent last. A guess notes how
+ * many there are, and when it fails the changes made since are undone, so the state is
+ * just as it was before the guess
+ */
+_Thread_local struct change* trail = NULL;
+_Thread_local int trail_num = 0;
+_Thread_local int trail_size = 0;
+
+/**
+ * @brief Code words marked dirty since the possible letters were last collected, in the
+ * order they were marked. A code word may be listed more than once, or be listed but no
+ * longer dirty once a change is undone
+ */
+_Thread_local struct cwrd** dirtied = NULL;
+_Thread_local int num_dirtied = 0;
+_Thread_local int dirtied_size = 0;
+
+/**
+ * @brief Threads searching in parallel, or NULL when searching on this thread alone. Each
+ * thread starts from its own copy of parsed, the puzzle as it was read, and the first
+ * solution any finds is kept in solution. worker is each thread's number in the pool and
+ * frames counts the guesses it has shared, to take back the jobs made for them
+ */
+struct pool* pool = NULL;
+int num_threads = 1;
+struct puzzle* parsed = NULL;
+char solution[26];
+char found = 0;
+_Thread_local int worker = 0;
+_Thread_local int frames = 0;
+
+/**
+ * @brief The rules the code letter to guess can be chosen by, and the one in use:
+ * dom: fewest possible letters
+ * dom/wdeg: fewest possible letters over the conflicts of the code words using the code
+ *     letter, which grow each time one of the code word's code letters has none left
+ * dom/deg: fewest possible letters over the number of places the code letter is used
+ * impact: fewest possible letters, scaled down by how much guessing the code letter has
+ *     shrunk the search on average
+ */
+struct heuristic heuristics[] = {
+    {"dom", scoreDom},
+    {"dom/wdeg", scoreDomWdeg},
+    {"dom/deg", scoreDomDeg},
+    {"impact", scoreImpact},
+    {NULL, NULL}
+};
+struct heuristic* heuristic = heuristics;
+
+/**
+ * @brief Average share of the search space ruled out by guessing each code letter, and
+ * the number of guesses it is from. A guess that fails straight away rules it all out.
+ * measure points at where the next search space worked out should go, if anywhere
+ */
+_Thread_local double impact[26];
+_Thread_local int impact_num[26];
+_Thread_local double *measure = NULL;
+
+/**
+ * @brief Number of times solve was called (nodes of the search) and of guesses that
+ * failed (backtracks), by this thread and in total
+ */
+_Thread_local uint64_t nodes = 0;
+_Thread_local uint64_t backtracks = 0;
+uint64_t total_nodes = 0;
+uint64_t total_backtracks = 0;
 
 int main(int argc, char **argv) {
     // Represent board as array of arrays of integers, also keep pattern
@@ -90,17 +311,104 @@ int main(int argc, char **argv) {
     // Continue as stated
 
     // Arguments
-    if (argc != 2) {
-        printf("Usage: $ %s <file_name>\n", argv[0]);
-        printf("where file_name is the location of the puzzle file\n");
+    char *file_name = NULL;
+    char *dictionary = NULL;
+    char bad = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dict") == 0 && i + 1 < argc) {
+            dictionary = argv[++i];
+        } else if (strcmp(argv[i], "--rank") == 0 && i + 1 < argc) {
+            char *end;
+            rank_size = strtol(argv[++i], &end, 10);
+            if (*end || rank_size < 1) {
+                printf("Number of solutions to rank must be at least 1, not '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            char *end;
+            cache_size = strtol(argv[++i], &end, 10);
+            if (*end || cache_size < 0) {
+                printf("Number of results to cache must be at least 0, not '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            char *end;
+            num_threads = strtol(argv[++i], &end, 10);
+            if (*end || num_threads < 1 || num_threads > MAX_POOL_THREADS) {
+                printf("Thread count must be between 1 and %d, not '%s'\n", MAX_POOL_THREADS, argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--all") == 0) {
+            enumerate = ENUMERATE_ALL;
+        } else if (strcmp(argv[i], "--count") == 0) {
+            enumerate = ENUMERATE_COUNT;
+        } else if (strcmp(argv[i], "--unique") == 0) {
+            enumerate = ENUMERATE_UNIQUE;
+        } else if (strcmp(argv[i], "--heuristic") == 0 && i + 1 < argc) {
+            heuristic = heuristics;
+            while (heuristic->name && strcmp(heuristic->name, argv[i + 1]) != 0) {
+                heuristic++;
+            }
+            if (!heuristic->name) {
+                printf("Unknown heuristic '%s'\n", argv[i + 1]);
+                return -1;
+            }
+            i++;
+        } else if (!file_name) {
+            file_name = argv[i];
+        } else {
+            bad = 1;
+        }
+    }
+
+    if (!file_name || bad || (rank_size && enumerate)) {
+        printf("Usage: $ %s [--dict dir] [--rank k | --all | --count | --unique] [--cache n] [--threads n]\n", argv[0]);
+        printf("       [--heuristic h] <file_name>\n");
+        printf("where file_name is the location of the puzzle file,\n");
+        printf("--dict gives the directory of the dictionary to use instead of 'data',\n");
+        printf("--rank finds every solution and reports the k most likely\n");
+        printf("--all prints every solution, --count only counts them,\n");
+        printf("--unique finds whether there is exactly one, stopping at a second\n");
+        printf("--cache keeps the possible letters of up to n code words (0 for none, default %d)\n",
+            CACHE_DEFAULT_SIZE);
+        printf("--threads searches with n threads (default 1)\n");
+        printf("and --heuristic chooses the code letter to guess by dom (default), dom/wdeg, dom/deg or impact\n");
         return -1;
     }
 
-    // Initialise the data module - read words list so ready to search for words
-    init();
-    
+    if (rank_size) {
+        ranked = calloc(rank_size, sizeof(struct ranked));
+        if (!ranked) {
+            perror("Failed to allocate ranked solutions");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (cache_size) {
+        collected = newCache(cache_size);
+    }
+
+    // Load the dictionary - read words list so ready to search for words
+    struct data_store* store = dictionary ? loadDictionary(dictionary, dictionary) : init();
+
+    // Only the puzzle's own buckets are searched, so only they are read
+    readLazily(store);
+
     // Parse the puzzle file pointed to
-    puzzle = parse(argv[1]);
+    puzzle = parse(file_name, store);
+    reader = newCursor(store);
+
+    // Every code word starts out dirty
+    for (int i = 0; puzzle->cwrds[i]; i++) {
+        addDirty(puzzle->cwrds[i]);
+    }
+
+    // Other threads start from a copy of the puzzle as it was read
+    if (num_threads > 1) {
+        parsed = copyPuzzle(puzzle);
+        pool = newPool(num_threads, runWorker);
+        startPool(pool);
+    }
 
     // Print out code letters that are in use if in verbose mode
     #if VERBOSE
@@ -114,10 +422,48 @@ int main(int argc, char **argv) {
         if (!puzzle->needed[i]) printf(" %d", i + 1);
     }
     printf("\n");
+
+    // Code words with no matching words make the puzzle unsolvable
+    for (int i = 0; puzzle->cwrds[i]; i++) {
+        struct cwrd* cw = puzzle->cwrds[i];
+        if (cw->bucket >= 0) continue;
+
+        printf("no words match the pattern of code word");
+        for (int j = 0; j < cw->len; j++) printf(" %d", cw->clets[j]);
+        printf("\n");
+    }
     #endif
 
-    // Attempt to solve the puzzle
-    if (solve()) {
+    // Attempt to solve the puzzle. In rank mode the search finds every solution, and the
+    // most likely one is used. When enumerating, the first one found is used
+    char solved = solve();
+    if (pool) {
+        // This thread's part is done, so it helps the others until every guess is tried
+        finishJob(pool);
+        searchJobs();
+        joinPool(pool);
+
+        solved = found;
+        if (found) {
+            memcpy(puzzle->known, solution, 26);
+        }
+
+        v("Search pool: %d threads, %llu guesses shared, %llu taken by other threads\n",
+            num_threads, atomic_load(&(pool->made)), atomic_load(&(pool->stolen)));
+    }
+    if (rank_size) {
+        solved = reportRanked();
+    }
+    if (enumerate) {
+        solved = reportSolutions();
+    }
+
+    total_nodes += nodes;
+    total_backtracks += backtracks;
+    v("Search: %" PRIu64 " nodes, %" PRIu64 " backtracks with heuristic %s\n",
+        total_nodes, total_backtracks, heuristic->name);
+
+    if (solved) {
         printf("Puzzle Solved\n");
     } else {
         printf("Puzzle Not Solved\n");
@@ -146,9 +492,29 @@ int main(int argc, char **argv) {
 
         cwrds++;
     }
+
+    if (collected) {
+        cache_hits += collected->hits;
+        cache_misses += collected->misses;
+        printf("Collect cache: %" PRIu64 " hits, %" PRIu64 " misses\n", cache_hits, cache_misses);
+    }
     #endif
 
+    // Go back to the state the search started from, so each code word holds the only
+    // copy of its arrays
+    undo(0);
+    free(trail);
+    free(dirtied);
+
+    freePool(pool);
+    if (parsed) {
+        freePuzzle(parsed);
+    }
+    freeCursor(reader);
     freePuzzle(puzzle);
+    freeCache(collected);
+    free(ranked);
+    freeDictionaries();
 
     return 0;
 }
@@ -159,6 +525,12 @@ int main(int argc, char **argv) {
  * @return char 1 on success, 0 on failure
  */
 char solve() {
+    // Another thread has found a solution
+    if (pool && poolStopped(pool)) {
+        return 0;
+    }
+    nodes++;
+
     // Check for case where all solutions found
     int t = 0;
     for (int i = 0; i < 26; i++) {
@@ -168,6 +540,29 @@ char solve() {
     }
     if (t == 26) {
         v("All required letters decoded\n");
+
+        // Letters found together can each fit a code word but not all at once
+        double score = solutionScore();
+        if (isnan(score)) {
+            v("Decoded code word is not a word\n");
+            return 0;
+        }
+
+        // Keep searching for the other solutions in rank mode
+        if (rank_size) {
+            rankSolution(score);
+            return 0;
+        }
+
+        // and when enumerating them, until a second shows the solution is not unique
+        if (enumerate) {
+            return countSolution();
+        }
+
+        if (pool) {
+            keepSolution();
+        }
+
         return 1;
     }
 
@@ -204,6 +599,29 @@ char solve() {
     // Collect possible decodings for each code word and collate results
     collatePossibilities();
 
+    // In rank mode, give up on solutions that cannot be more likely than those found
+    if (rank_size && outranked()) {
+        v("Cannot beat the ranked solutions\n");
+        return 0;
+    }
+
+    // Every code letter needs a different letter, which can rule more letters out
+    if (!propagate()) {
+        if (measure) {
+            *measure = -INFINITY;
+            measure = NULL;
+        }
+
+        v("No possible solutions\n");
+        return 0;
+    }
+
+    // The search space left after a guess shows the guess's impact
+    if (measure) {
+        *measure = searchSpace();
+        measure = NULL;
+    }
+
     #if DEBUG
     printf("Collated possibilities\n");
     for (int i = 0; i < 26; i++) {
@@ -280,41 +698,289 @@ char solve() {
  * Hence, finds the possible solutions for each codeletter that fit all codewords 
  */
 void collatePossibilities() {
-    // Reset possibility sets
-    for (int i = 0; i < 26; i++) {
-        possible[i] = FULL_SET;
+    // Code words sharing a bucket are collected together, so the bucket is read once.
+    // Only the code words marked dirty since the last time can be out of date
+    int num = num_dirtied;
+
+    struct cwrd** group = malloc(num * sizeof(struct cwrd*));
+    if (!group && num) {
+        perror("Failed to allocate code word group");
+        exit(EXIT_FAILURE);
     }
 
-    // Collect and collate
-    struct cwrd** cs = puzzle->cwrds;
-    struct cwrd* cw;
-    while (cw = *cs) {
-        // If the codeword has been changed (one of its codeletters decoded) since last calculation of
-        // possibilities for its letters, recalculate. Else, use already calculated values
-        if (cw->dirty) {
-            // Calculate possibilities for this codeword
-            collect(cw);
+    struct cwrd** pending = malloc(num * sizeof(struct cwrd*));
+    if (!pending && num) {
+        perror("Failed to allocate code word group");
+        exit(EXIT_FAILURE);
+    }
 
-            // Reset dirty bit
-            cw->dirty = 0;
+    // Those the bucket's summary or the cache answers need no words reading, nor do those
+    // that can pick their words out of the words they had before. A code word listed twice
+    // is no longer dirty the second time
+    int num_pending = 0;
+    for (int j = 0; j < num; j++) {
+        struct cwrd* cw = dirtied[j];
+        if (!stale(cw)) {
+            continue;
         }
 
-        // Collate each value in possibilities list with total list, for each codeletter in word
-        for (int i = 0; i < cw->len; i++) {
-            d("  possibilities (%d) %x\n", cw->clets[i], cw->possible[i]);
+        saveCwrd(cw);
+        prepareCollect(cw);
+        outdate(cw);
+        if (!collectSummary(cw) && !recall(cw) && !narrow(cw)) {
+            pending[num_pending++] = cw;
+        }
+    }
+    num_dirtied = 0;
+
+    // Link each code word to the next one with the same bucket, through a table from
+    // bucket to the last code word seen with it, so grouping only looks at one bucket's
+    int size = 1;
+    while (size < num_pending * 2) {
+        size *= 2;
+    }
 
-            int clet = cw->clets[i] - 1;
-            possible[clet] = possible[clet] & cw->possible[i];
+    int *last = malloc(size * sizeof(int));
+    int *next = malloc(num_pending * sizeof(int));
+    if (!last || (!next && num_pending)) {
+        perror("Failed to allocate code word group");
+        exit(EXIT_FAILURE);
+    }
+    for (int h = 0; h < size; h++) {
+        last[h] = -1;
+    }
+
+    for (int j = 0; j < num_pending; j++) {
+        int bucket = pending[j]->bucket;
+        uint32_t h = ((uint32_t) bucket * 2654435761u) & (size - 1);
+        while (last[h] >= 0 && pending[last[h]]->bucket != bucket) {
+            h = (h + 1) & (size - 1);
         }
 
-        // next
-        cs++;
+        if (last[h] >= 0) {
+            next[last[h]] = j;
+        }
+        last[h] = j;
+        next[j] = num_pending;
+    }
+
+    for (int j = 0; j < num_pending; j++) {
+        if (!pending[j]) {
+            continue;
+        }
+
+        // A bucket searched by its postings only gives the words with the known letters, so
+        // a code word knowing other letters reads fewer words on its own
+        struct cwrd* first = pending[j];
+        char postings = first->bucket >= 0 && puzzle->store->patterns[first->bucket].postings;
+
+        int n = 0;
+        for (int k = j; k < num_pending; k = next[k]) {
+            if (pending[k] && (!postings || memcmp(pending[k]->known, first->known, first->len) == 0)) {
+                group[n++] = pending[k];
+                pending[k] = NULL;
+            }
+        }
+
+        if (n == 1) {
+            collect(group[0]);
+        } else {
+            collectGroup(group, n);
+        }
     }
 
+    free(group);
+    free(pending);
+    free(last);
+    free(next);
+
+    // Collate again the code letters of the code words that changed, from each place the
+    // code letter is used
+    for (int clet = 0; clet < 26; clet++) {
+        if (!(outdated & (0x1 << clet))) {
+            continue;
+        }
+
+        matching[clet] = FULL_SET;
+        memset(likelihood[clet], 0, sizeof(likelihood[clet]));
+
+        for (int k = 0; k < puzzle->num_uses[clet]; k++) {
+            struct cwrd* cw = puzzle->uses[clet][k].cw;
+            int i = puzzle->uses[clet][k].pos;
+
+            d("  possibilities (%d) %x\n", clet + 1, cw->possible[i]);
+
+            matching[clet] &= cw->possible[i];
+
+            // Each use is independent evidence, so the log shares add up
+            for (int l = 0; l < 26; l++) {
+                likelihood[clet][l] += cw->likelihood[i * 26 + l];
+            }
+        }
+    }
+    outdated = 0;
+
     // Remove from possibility list any letters which have already been used elsewhere
     for (int i = 0; i < 26; i++) {
-        possible[i] = possible[i] & (~used);
+        possible[i] = matching[i] & (~used);
+    }
+}
+
+/**
+ * @brief Narrow the possible letters of the code letters still to be found, using that
+ * each needs a different letter. When k of them (up to NAKED_MAX) can only be k letters
+ * between them, no other code letter can be those letters. When there are as many code
+ * letters to find as letters left, every letter left is used, so a letter only one code
+ * letter can be must be that code letter's. Repeats until nothing changes
+ * @return char 1, or 0 if the code letters cannot all be given different letters
+ */
+char propagate() {
+    int clets[26];
+    int num = 0;
+    for (int i = 0; i < 26; i++) {
+        if (puzzle->needed[i] && !puzzle->known[i]) {
+            clets[num++] = i;
+        }
+    }
+
+    uint32_t left = FULL_SET & ~used;
+    char all_used = count(left) == num;
+
+    #if VERBOSE
+    uint32_t before[26];
+    memcpy(before, possible, sizeof(possible));
+    #endif
+
+    char changed = 1;
+    while (changed) {
+        changed = 0;
+
+        // Naked singles, pairs and triples
+        int in[NAKED_MAX];
+        for (int a = 0; a < num; a++) {
+            in[0] = a;
+            int r = nakedSubset(in, 1, clets, num);
+            if (r < 0) {
+                return 0;
+            }
+            changed |= r;
+
+            for (int b = a + 1; b < num; b++) {
+                if (count(possible[clets[a]] | possible[clets[b]]) > NAKED_MAX) {
+                    continue;
+                }
+
+                in[1] = b;
+                r = nakedSubset(in, 2, clets, num);
+                if (r < 0) {
+                    return 0;
+                }
+                changed |= r;
+
+                for (int c = b + 1; c < num; c++) {
+                    in[2] = c;
+                    r = nakedSubset(in, 3, clets, num);
+                    if (r < 0) {
+                        return 0;
+                    }
+                    changed |= r;
+                }
+            }
+        }
+
+        // Hidden singles
+        for (int l = 0; all_used && l < 26; l++) {
+            uint32_t mask = 0x1 << l;
+            if (!(left & mask)) {
+                continue;
+            }
+
+            int n = 0;
+            int only = -1;
+            for (int j = 0; j < num; j++) {
+                if (possible[clets[j]] & mask) {
+                    n++;
+                    only = clets[j];
+                }
+            }
+
+            if (n == 0) {
+                d("    letter %c fits no code letter\n", 'a' + l);
+                return 0;
+            }
+            if (n == 1 && possible[only] != mask) {
+                d("    letter %c only fits code letter %d\n", 'a' + l, only + 1);
+                possible[only] = mask;
+                changed = 1;
+            }
+        }
+    }
+
+    #if VERBOSE
+    int narrowed = 0;
+    for (int i = 0; i < 26; i++) {
+        narrowed += possible[i] != before[i];
+    }
+    if (narrowed) {
+        printf("Narrowed %d code letters by propagation\n", narrowed);
+    }
+    #endif
+
+    return 1;
+}
+
+/**
+ * @brief Rule the letters of a set of code letters out of the other code letters, if
+ * there are as many letters as code letters in the set
+ * @param in positions in clets of the code letters in the set
+ * @param k number of code letters in the set
+ * @param clets code letters still to be found
+ * @param num number of code letters still to be found
+ * @return int 1 if any letters were ruled out, 0 if none were, -1 if the set has fewer
+ * letters than code letters or a code letter is left with none
+ */
+int nakedSubset(int *in, int k, int *clets, int num) {
+    uint32_t letters = 0;
+    for (int j = 0; j < k; j++) {
+        letters |= possible[clets[in[j]]];
+    }
+
+    int n = count(letters);
+    if (n < k) {
+        d("    %d code letters share %d letters\n", k, n);
+        for (int j = 0; j < k; j++) {
+            blame(clets[in[j]]);
+        }
+        return -1;
+    }
+    if (n > k) {
+        return 0;
+    }
+
+    int changed = 0;
+    for (int j = 0; j < num; j++) {
+        uint32_t *p = possible + clets[j];
+        if (!(*p & letters)) {
+            continue;
+        }
+
+        int e = 0;
+        while (e < k && in[e] != j) {
+            e++;
+        }
+        if (e < k) {
+            continue;
+        }
+
+        *p &= ~letters;
+        changed = 1;
+        if (!*p) {
+            blame(clets[j]);
+            return -1;
+        }
     }
+
+    return changed;
 }
 
 /**
@@ -334,10 +1000,13 @@ int findSolutions(char *solutions, int *guessable, int *guessable_num) {
     // Count number of definite solutions found
     int num = 0;
 
+    // Score of the most guessable code letter
+    double best = INFINITY;
+
     // For each codeletter
     for (int i = 0; i < 26; i++) {
-        // Ignore codeletters where the letter is already known
-        if (puzzle->known[i]) {
+        // Ignore codeletters where the letter is already known, or that no code word uses
+        if (puzzle->known[i] || !puzzle->needed[i]) {
             continue;
         }
 
@@ -350,6 +1019,7 @@ int findSolutions(char *solutions, int *guessable, int *guessable_num) {
             // No possible solutions - error
 
             d(" - failure\n");
+            blame(i);
 
             // return failure
             return -1;
@@ -372,8 +1042,10 @@ int findSolutions(char *solutions, int *guessable, int *guessable_num) {
         } else {
             // More than one possibility - still a guessable codeletter - maybe save for later
             
-            // If this letter has the fewest solutions of those seen so far (>1), save if for later
-            if (*guessable_num == -1 || *guessable_num > n) {
+            // If this letter has the best score of those seen so far, save it for later
+            double score = heuristic->score(i, n);
+            if (*guessable_num == -1 || score < best) {
+                best = score;
                 *guessable_num = n;
                 *guessable = i;
 
@@ -402,96 +1074,881 @@ char noSolutions(int guessable_num, int guessable) {
         return 0;
     }
 
-    // Iterate over possible solutions for the guessable code letter
-    uint32_t mask = 0x1;
+    // Order the possible solutions for the guessable code letter, most likely first. Ties
+    // stay in alphabetical order. The order is kept here as guessing changes the globals
+    char order[26];
+    int n = 0;
     for (char i = 0; i < 26; i++) {
-        if (mask & possible[guessable]) {
-            // choose this letter
-            char c = i + 'a';
+        if (!((0x1 << i) & possible[guessable])) {
+            continue;
+        }
 
-            // Add to list of guesses
-            puzzle->known[guessable] = c;
+        int at = n++;
+        while (at > 0 && likelihood[guessable][(int) order[at - 1]] < likelihood[guessable][(int) i]) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = i;
+    }
 
-            // Mark this letter as changed for all relevant code words
-            markDirty(guessable);
+    // Search space before guessing, to measure the guesses' impact by
+    double space = searchSpace();
 
-            v("Guessing %d -> %c\n", guessable + 1, c);
+    // Other threads may take the guesses
+    if (pool) {
+        return shareGuesses(order, n, guessable, space);
+    }
 
-            // Attempt to solve with this guess
-            if (solve()) {
-                // Guessed correctly
-                return 1;
-            }
+    // State before guessing, to go back to when a guess fails
+    int mark = trail_num;
 
-            v("(guess failed)\n");
+    for (int j = 0; j < n; j++) {
+        // Attempt to solve with this guess
+        if (tryGuess(guessable, order[j] + 'a', mark, space)) {
+            // Guessed correctly
+            return 1;
         }
-
-        mask = mask << 1;
     }
 
     // None of the guesses produced a solution - return failure
-    
-    // Remove assumed solutions
-    puzzle->known[guessable] = 0;
-
     v("No guess produced solution\n");
     return 0;
 }
 
 /**
- * @brief Recursively solve if at least one definite solution found
- * @param solutions solutions found (i-th entry represents decoding of codeletter i)
- * @return char 0 on failure, 1 on success
+ * @brief Guess a letter for a code letter and try to solve from there
+ * @param clet code letter guessed
+ * @param c letter guessed
+ * @param mark number of entries on the trail before the guess, to go back to when it fails
+ * @param space search space before the guess, as given by searchSpace, or NAN if unknown
+ * @return char 1 on success, 0 on failure
  */
-char recurse(char *solutions) {
-    // Add solutions to values and recurse
-    for (int i = 0; i < 26; i++) {
-        if (solutions[i] == 0) {
-            continue;
-        }
+char tryGuess(int clet, char c, int mark, double space) {
+    // Add to list of guesses, marking the code words using it as changed
+    setKnown(clet, c);
 
-        // Add to puzzle list
-        char s = solutions[i];
-        puzzle->known[i] = s;
+    v("Guessing %d -> %c\n", clet + 1, c);
 
-        // Mark all codewords that use codeletter i as dirty
-        markDirty(i);
+    // The search space after the guess is measured by the solve it starts
+    double after = NAN;
+    double *outer = measure;
+    measure = &after;
+
+    char ret = solve();
+    measure = outer;
+    if (!isnan(space) && !isnan(after)) {
+        noteImpact(clet, space, after);
     }
 
-    // Otherwise recurse
-    return solve();
+    if (ret) {
+        return 1;
+    }
+
+    backtracks++;
+    v("(guess failed)\n");
+
+    // Remove the guess and everything found from it
+    undo(mark);
+    return 0;
 }
 
 /**
- * @brief Collects, for each number, the list of possible letters matching the pattern
- * @param cw Representation of the code word
+ * @brief Try the guesses for a code letter in order as noSolutions does, while letting
+ * other threads take the ones not yet tried. Every guess after the first becomes a job,
+ * the most likely newest, so this thread takes them back in order while threads with
+ * nothing to do take the least likely
+ * @param order letters to guess, as numbers from 0, most likely first
+ * @param n number of letters to guess
+ * @param guessable code letter to guess
+ * @param space search space before guessing, as given by searchSpace
+ * @return char 1 on success, 0 on failure
  */
-void collect(struct cwrd* cw) {
-    // Reset possibility sets
-    for (int i = 0; i < cw->len; i++) {
-        cw->possible[i] = 0;
-    }
-    
-    #if DEBUG
-    printf("    filled pattern =");
-    for (int i = 0; i < cw->len; i++) {
-        printf(" %d", cw->known[i]);
+char shareGuesses(char *order, int n, int guessable, double space) {
+    int frame = ++frames;
+    int mark = trail_num;
+
+    for (int j = n - 1; j > 0; j--) {
+        struct guess* g = malloc(sizeof(struct guess));
+        if (!g) {
+            perror("Failed to allocate guess");
+            exit(EXIT_FAILURE);
+        }
+
+        memcpy(g->known, puzzle->known, 26);
+        g->clet = guessable;
+        g->letter = order[j] + 'a';
+        pushJob(pool, worker, g, frame);
     }
-    printf("\n");
-    #endif
 
-    // Construct pattern
-    for (int i = 0; i < cw->len; i++) {
-        // If the cw doesn't know position i and the puzzel does, move it into the known field
-        if (cw->known[i] == 0 && puzzle->known[cw->clets[i] - 1]) {
-            d("  position=%d code-letter=%d known-value=%d puzzle-known=%d\n",
-                i, cw->known[i], cw->clets[i] - 1, puzzle->known[cw->clets[i] - 1]);
-            
-            cw->known[i] = puzzle->known[cw->clets[i] - 1];
-        }
+    char ret = tryGuess(guessable, order[0] + 'a', mark, space);
+
+    struct guess* g;
+    while (!ret && (g = popJob(pool, worker, frame))) {
+        ret = tryGuess(g->clet, g->letter, mark, space);
+        free(g);
+        finishJob(pool);
     }
 
-    #if DEBUG
+    if (!ret) {
+        v("No guess produced solution\n");
+    }
+    return ret;
+}
+
+/**
+ * @brief Search on a thread the pool started, with its own copy of the puzzle
+ * @param id the thread's number in the pool
+ */
+void runWorker(int id) {
+    worker = id;
+    puzzle = copyPuzzle(parsed);
+    reader = newCursor(puzzle->store);
+    if (cache_size) {
+        collected = newCache(cache_size);
+    }
+
+    for (int i = 0; puzzle->cwrds[i]; i++) {
+        addDirty(puzzle->cwrds[i]);
+    }
+
+    searchJobs();
+
+    undo(0);
+    free(trail);
+    free(dirtied);
+
+    lockPool(pool);
+    if (collected) {
+        cache_hits += collected->hits;
+        cache_misses += collected->misses;
+    }
+    total_nodes += nodes;
+    total_backtracks += backtracks;
+    unlockPool(pool);
+
+    freeCache(collected);
+    freeCursor(reader);
+    freePuzzle(puzzle);
+}
+
+/**
+ * @brief Try the guesses of other threads, and any of this thread's own left when its
+ * search returned, until every guess is tried or a solution is found
+ */
+void searchJobs() {
+    struct guess* g;
+    while (g = takeJob(pool, worker)) {
+        // Go back as far as the first letter found that the guess was not made with, then
+        // on to the state the guess was made in. A code letter found keeps its letter until
+        // the change is undone, so the puzzle knows the letter each change found
+        int mark = 0;
+        while (mark < trail_num && (trail[mark].cw || g->known[trail[mark].clet] == puzzle->known[trail[mark].clet])) {
+            mark++;
+        }
+
+        undo(mark);
+        for (int i = 0; i < 26; i++) {
+            if (puzzle->known[i] != g->known[i]) {
+                setKnown(i, g->known[i]);
+            }
+        }
+
+        tryGuess(g->clet, g->letter, trail_num, NAN);
+        free(g);
+        finishJob(pool);
+    }
+}
+
+/**
+ * @brief Keep the solution this thread has found, unless another thread found one first,
+ * and stop the other threads
+ */
+void keepSolution() {
+    lockPool(pool);
+    if (!found) {
+        found = 1;
+        memcpy(solution, puzzle->known, 26);
+    }
+    unlockPool(pool);
+
+    stopPool(pool);
+}
+
+/**
+ * @brief Count a conflict against every code word using a code letter that was left with
+ * no letters, for the dom/wdeg heuristic. The counts are kept when guesses are undone
+ */
+void blame(int clet) {
+    for (int k = 0; k < puzzle->num_uses[clet]; k++) {
+        puzzle->uses[clet][k].cw->conflicts++;
+    }
+}
+
+/**
+ * @brief Work out the size of the search space left, as the log (base 2) of the product of
+ * the numbers of possible letters of the code letters still to be found
+ */
+double searchSpace() {
+    double space = 0;
+    for (int i = 0; i < 26; i++) {
+        if (puzzle->needed[i] && !puzzle->known[i]) {
+            space += log2(count(possible[i]));
+        }
+    }
+
+    return space;
+}
+
+/**
+ * @brief Add the impact of a guess on a code letter to the code letter's average
+ * @param before search space before the guess
+ * @param after search space after the guess, -INFINITY if the guess failed straight away
+ */
+void noteImpact(int clet, double before, double after) {
+    double share = 1 - exp2(after - before);
+    if (share < 0) {
+        share = 0;
+    }
+
+    impact[clet] = (impact[clet] * impact_num[clet] + share) / (impact_num[clet] + 1);
+    impact_num[clet]++;
+}
+
+/**
+ * @brief Score a code letter by its number of possible letters alone
+ */
+double scoreDom(int clet, int n) {
+    // Every heuristic is given the code letter, though this one does not need it
+    (void) clet;
+    return n;
+}
+
+/**
+ * @brief Score a code letter by its number of possible letters over the conflicts of the
+ * code words using it. Code words with no other code letters to find still count, as
+ * their words still limit the code letter's letters
+ */
+double scoreDomWdeg(int clet, int n) {
+    int wdeg = 0;
+    struct cwrd* last = NULL;
+    for (int k = 0; k < puzzle->num_uses[clet]; k++) {
+        struct cwrd* cw = puzzle->uses[clet][k].cw;
+        if (cw != last) {
+            wdeg += cw->conflicts;
+        }
+        last = cw;
+    }
+
+    return (double) n / wdeg;
+}
+
+/**
+ * @brief Score a code letter by its number of possible letters over the number of places
+ * it is used
+ */
+double scoreDomDeg(int clet, int n) {
+    return (double) n / puzzle->num_uses[clet];
+}
+
+/**
+ * @brief Score a code letter by its number of possible letters, scaled down by the
+ * average share of the search space its guesses have ruled out. A code letter not yet
+ * guessed is scored by its number of possible letters alone
+ */
+double scoreImpact(int clet, int n) {
+    return n * (1 - impact[clet]);
+}
+
+/**
+ * @brief Recursively solve if at least one definite solution found
+ * @param solutions solutions found (i-th entry represents decoding of codeletter i)
+ * @return char 0 on failure, 1 on success
+ */
+char recurse(char *solutions) {
+    // Add solutions to values and recurse
+    for (int i = 0; i < 26; i++) {
+        if (solutions[i] == 0) {
+            continue;
+        }
+
+        // Add to puzzle list, marking all codewords that use codeletter i as dirty
+        setKnown(i, solutions[i]);
+    }
+
+    // Otherwise recurse
+    return solve();
+}
+
+/**
+ * @brief Check whether a code word's possible letters need collecting again.
+ * They do if the codeword has been changed (one of its codeletters decoded) since they were
+ * last collected. Words were skipped for using letters that were used then, so if any of
+ * those letters are no longer used they are also out of date. Undoing a failed guess puts
+ * back the possible letters collected before it, so they never are after a guess fails
+ */
+char stale(struct cwrd* cw) {
+    return cw->dirty || (cw->used & ~used);
+}
+
+/**
+ * @brief Collects, for each number, the list of possible letters matching the pattern
+ * @param cw Representation of the code word, prepared by prepareCollect
+ */
+void collect(struct cwrd* cw) {
+    double total = 0;
+    double best = 0;
+
+    // Indicate to datastore that we are now searching using a different pattern.
+    // A code word without a bucket gives no words so every position has no possibilities.
+    // Words using letters that already decode other code letters are skipped, so they
+    // do not widen the sets of the other positions
+    cursorBucket(reader, cw->bucket, cw->known, used);
+    startWords(cw);
+    char keep = 1;
+
+    // Iterate over words matching pattern
+    char *word;
+    while (word = cursorNext(reader)) {
+        uint32_t weight = cursorWeight(reader);
+        total += weight;
+        if (weight > best) {
+            best = weight;
+        }
+
+        addWord(cw, word, weight);
+        if (keep) {
+            keep = keepWord(cw, word, weight);
+        }
+    }
+
+    finishCollect(cw, total, best);
+    remember(cw);
+}
+
+/**
+ * @brief Collects the possible letters of several code words that share a bucket with one
+ * pass over the bucket's words. The search only uses the letters every code word knows,
+ * and each word it gives is checked against each code word's own known letters and the
+ * letters it cannot use. The results are the same as collecting each code word alone
+ * @param group Code words to collect, all with the same bucket and prepared by prepareCollect
+ * @param n Number of code words in the group, at least one
+ */
+void collectGroup(struct cwrd** group, int n) {
+    int len = group[0]->len;
+
+    char *common = malloc(len);
+    double *totals = calloc(n, sizeof(double));
+    double *bests = calloc(n, sizeof(double));
+    uint32_t *exclude = malloc(n * sizeof(uint32_t));
+    char *keep = malloc(n);
+    int *same = malloc(n * sizeof(int));
+    if (!common || !totals || !bests || !exclude || !keep || !same) {
+        perror("Failed to allocate code word group");
+        exit(EXIT_FAILURE);
+    }
+
+    // Letters known in the same position by every code word, and every known letter
+    uint32_t known = 0;
+    for (int i = 0; i < len; i++) {
+        common[i] = group[0]->known[i];
+        for (int k = 0; k < n; k++) {
+            if (group[k]->known[i] != common[i]) {
+                common[i] = 0;
+            }
+            if (group[k]->known[i]) {
+                known |= 0x1 << (group[k]->known[i] - 'a');
+            }
+        }
+    }
+
+    // Each code word keeps the words it is given. One that knows the same letters and
+    // rules out the same ones as an earlier code word gets the same result, so is not
+    // matched against the words itself
+    for (int k = 0; k < n; k++) {
+        exclude[k] = excluded(group[k]);
+        startWords(group[k]);
+        keep[k] = 1;
+
+        same[k] = -1;
+        for (int e = 0; e < k && same[k] < 0; e++) {
+            if (same[e] < 0 && exclude[e] == exclude[k] && memcmp(group[e]->known, group[k]->known, len) == 0) {
+                same[k] = e;
+            }
+        }
+    }
+
+    // Used letters known by any of the code words must not rule a word out of the search
+    cursorBucket(reader, group[0]->bucket, common, used & ~known);
+
+    char *word;
+    while (word = cursorNext(reader)) {
+        uint32_t weight = cursorWeight(reader);
+
+        uint32_t letters = 0;
+        for (int i = 0; i < len; i++) {
+            letters |= 0x1 << (word[i] - 'a');
+        }
+
+        for (int k = 0; k < n; k++) {
+            struct cwrd* cw = group[k];
+            if (same[k] >= 0 || letters & exclude[k]) {
+                continue;
+            }
+
+            int i = 0;
+            while (i < len && (!cw->known[i] || cw->known[i] == word[i])) {
+                i++;
+            }
+            if (i < len) {
+                continue;
+            }
+
+            totals[k] += weight;
+            if (weight > bests[k]) {
+                bests[k] = weight;
+            }
+
+            addWord(cw, word, weight);
+            if (keep[k]) {
+                keep[k] = keepWord(cw, word, weight);
+            }
+        }
+    }
+
+    for (int k = 0; k < n; k++) {
+        struct cwrd* cw = group[k];
+        int e = same[k];
+        if (e >= 0) {
+            totals[k] = totals[e];
+            bests[k] = bests[e];
+            memcpy(cw->possible, group[e]->possible, len * sizeof(uint32_t));
+            memcpy(cw->likelihood, group[e]->likelihood, len * 26 * sizeof(double));
+            for (uint32_t w = 0; keep[e] && w < group[e]->num_words; w++) {
+                keepWord(cw, group[e]->words + (size_t) w * len, group[e]->weights[w]);
+            }
+            keep[k] = keep[e];
+        }
+    }
+
+    // A code word with the same result as an earlier one has the same key, so is only
+    // cached once
+    for (int k = 0; k < n; k++) {
+        finishCollect(group[k], totals[k], bests[k]);
+        if (same[k] < 0) {
+            remember(group[k]);
+        }
+    }
+
+    free(common);
+    free(totals);
+    free(bests);
+    free(exclude);
+    free(keep);
+    free(same);
+}
+
+/**
+ * @brief Collect the possible letters of a code word from its bucket's summary, which
+ * holds what reading every word in the bucket would give. It only applies while the code
+ * word knows none of its letters and no letters are used, so no word is ruled out
+ * @param cw Representation of the code word, prepared by prepareCollect
+ * @return char 1 if the code word was collected, 0 if its words must be read instead
+ */
+char collectSummary(struct cwrd* cw) {
+    if (used) {
+        return 0;
+    }
+
+    for (int i = 0; i < cw->len; i++) {
+        if (cw->known[i]) {
+            return 0;
+        }
+    }
+
+    uint64_t *summary = bucketSummary(puzzle->store, cw->bucket);
+    if (!summary) {
+        return 0;
+    }
+
+    uint32_t *letters = (uint32_t *) (summary + 2 + cw->len * 26);
+    for (int i = 0; i < cw->len; i++) {
+        cw->possible[i] = letters[i];
+    }
+    for (int i = 0; i < cw->len * 26; i++) {
+        cw->likelihood[i] = (double) summary[2 + i];
+    }
+
+    finishCollect(cw, (double) summary[0], (double) summary[1]);
+
+    return 1;
+}
+
+/**
+ * @brief Make the key a code word's possible letters are cached under: the dictionary,
+ * the bucket, the letters that rule a word out and the known letters. Code words with
+ * the same key always collect the same possible letters
+ * @param cw Representation of the code word, prepared by prepareCollect
+ * @param key space for the key, at least 16 + cw->len bytes
+ * @return size_t number of bytes in the key
+ */
+size_t collectKey(struct cwrd* cw, char *key) {
+    uint32_t exclude = excluded(cw);
+
+    uint64_t store = (uintptr_t) puzzle->store;
+    int32_t bucket = cw->bucket;
+    memcpy(key, &store, 8);
+    memcpy(key + 8, &bucket, 4);
+    memcpy(key + 12, &exclude, 4);
+    memcpy(key + 16, cw->known, cw->len);
+
+    return 16 + cw->len;
+}
+
+/**
+ * @brief Collect the possible letters of a code word from the cache, when they have been
+ * collected before with the same key
+ * @param cw Representation of the code word, prepared by prepareCollect
+ * @return char 1 if the code word was collected, 0 if its words must be read instead
+ */
+char recall(struct cwrd* cw) {
+    if (!collected) {
+        return 0;
+    }
+
+    char key[16 + cw->len];
+    char *value = cacheFind(collected, key, collectKey(cw, key));
+    if (!value) {
+        return 0;
+    }
+
+    // The value holds the best weight, the likelihoods then the possible letters
+    memcpy(&(cw->best), value, 8);
+    memcpy(cw->likelihood, value + 8, cw->len * 26 * sizeof(double));
+    memcpy(cw->possible, value + 8 + cw->len * 26 * sizeof(double), cw->len * 4);
+
+    return 1;
+}
+
+/**
+ * @brief Keep the possible letters just collected for a code word in the cache
+ * @param cw Representation of the code word, collected by finishCollect
+ */
+void remember(struct cwrd* cw) {
+    if (!collected) {
+        return;
+    }
+
+    char key[16 + cw->len];
+    size_t key_size = collectKey(cw, key);
+
+    size_t size = 8 + cw->len * 26 * sizeof(double) + cw->len * 4;
+    char value[size];
+    memcpy(value, &(cw->best), 8);
+    memcpy(value + 8, cw->likelihood, cw->len * 26 * sizeof(double));
+    memcpy(value + 8 + cw->len * 26 * sizeof(double), cw->possible, cw->len * 4);
+
+    cacheAdd(collected, key, key_size, value, size);
+}
+
+/**
+ * @brief Find the letters that rule a word out for a code word: those already used,
+ * apart from the code word's own known letters, which a word in its bucket only has
+ * where they are known
+ */
+uint32_t excluded(struct cwrd* cw) {
+    uint32_t exclude = used;
+    for (int i = 0; i < cw->len; i++) {
+        if (cw->known[i]) {
+            exclude &= ~(0x1 << (cw->known[i] - 'a'));
+        }
+    }
+
+    return exclude;
+}
+
+/**
+ * @brief Collect the possible letters of a code word from the words it had before, when
+ * it knows every letter they were found with and rules out every letter they ruled out.
+ * The words that no longer match are moved after those that do, so going back to the
+ * words before only needs the number of words restoring
+ * @param cw Representation of the code word, prepared by prepareCollect
+ * @return char 1 if the code word was collected, 0 if its words must be read instead
+ */
+char narrow(struct cwrd* cw) {
+    if (!cw->words) {
+        return 0;
+    }
+
+    uint32_t exclude = excluded(cw);
+    if (cw->words_exclude & ~exclude) {
+        return 0;
+    }
+    for (int i = 0; i < cw->len; i++) {
+        if (cw->words_known[i] && cw->words_known[i] != cw->known[i]) {
+            return 0;
+        }
+    }
+
+    memcpy(cw->words_known, cw->known, cw->len);
+    cw->words_exclude = exclude;
+
+    double total = 0;
+    double best = 0;
+
+    char swap[cw->len];
+    uint32_t num = 0;
+    for (uint32_t w = 0; w < cw->num_words; w++) {
+        char *word = cw->words + (size_t) w * cw->len;
+
+        int i = 0;
+        uint32_t letters = 0;
+        while (i < cw->len && (!cw->known[i] || cw->known[i] == word[i])) {
+            letters |= 0x1 << (word[i] - 'a');
+            i++;
+        }
+        if (i < cw->len || (letters & exclude)) {
+            continue;
+        }
+
+        uint32_t weight = cw->weights[w];
+        total += weight;
+        if (weight > best) {
+            best = weight;
+        }
+        addWord(cw, word, weight);
+
+        // Swap to the end of the words that match
+        char *to = cw->words + (size_t) num * cw->len;
+        if (to != word) {
+            memcpy(swap, to, cw->len);
+            memcpy(to, word, cw->len);
+            memcpy(word, swap, cw->len);
+        }
+        cw->weights[w] = cw->weights[num];
+        cw->weights[num] = weight;
+        num++;
+    }
+    cw->num_words = num;
+
+    finishCollect(cw, total, best);
+    remember(cw);
+
+    return 1;
+}
+
+/**
+ * @brief Start a new list of words for a code word about to have its words read, found
+ * with its known letters and the letters ruled out now. The old list belongs to the trail
+ */
+void startWords(struct cwrd* cw) {
+    cw->words = NULL;
+    cw->weights = NULL;
+    cw->num_words = 0;
+    cw->words_size = 0;
+    memcpy(cw->words_known, cw->known, cw->len);
+    cw->words_exclude = excluded(cw);
+}
+
+/**
+ * @brief Add a word to the end of a code word's list of words. A list that grows too
+ * long to be worth keeping is dropped
+ * @param word letters of the word, copied into the list
+ * @param weight the word's weight
+ * @return char 1 to keep adding the words read, 0 once the list has been dropped
+ */
+char keepWord(struct cwrd* cw, char *word, uint32_t weight) {
+    if (cw->num_words == cw->words_size) {
+        if (cw->num_words >= wordsLimit(cw)) {
+            free(cw->words);
+            free(cw->weights);
+            cw->words = NULL;
+            cw->weights = NULL;
+            cw->num_words = 0;
+            cw->words_size = 0;
+            return 0;
+        }
+
+        cw->words_size = cw->words_size ? cw->words_size * 2 : 16;
+        cw->words = realloc(cw->words, (size_t) cw->words_size * cw->len);
+        cw->weights = realloc(cw->weights, cw->words_size * sizeof(uint32_t));
+        if (!cw->words || !cw->weights) {
+            perror("Failed to allocate code word's words");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(cw->words + (size_t) cw->num_words * cw->len, word, cw->len);
+    cw->weights[cw->num_words] = weight;
+    cw->num_words++;
+
+    return 1;
+}
+
+/**
+ * @brief Find the most words worth keeping in a code word's list. Picking words out of
+ * a list reads every word in it, while searching a bucket by its postings only reads the
+ * words that match, so for those buckets only lists much shorter than the bucket are kept
+ */
+uint32_t wordsLimit(struct cwrd* cw) {
+    struct pattern* p = puzzle->store->patterns + cw->bucket;
+    if (!p->postings) {
+        return UINT32_MAX;
+    }
+
+    return p->blocks * 64 / WORDS_FRACTION;
+}
+
+/**
+ * @brief Make room for another change on the trail
+ * @return struct change* the new change, with no code word
+ */
+struct change* newChange() {
+    if (trail_num == trail_size) {
+        trail_size = trail_size ? trail_size * 2 : 64;
+        trail = realloc(trail, trail_size * sizeof(struct change));
+        if (!trail) {
+            perror("Failed to allocate trail");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct change* ch = trail + trail_num++;
+    ch->cw = NULL;
+    ch->known = NULL;
+
+    return ch;
+}
+
+/**
+ * @brief Set the letter a code letter is known as, keeping the old one on the trail, and
+ * mark the code words using it as dirty
+ * @param i code letter
+ * @param c letter it is known as
+ */
+void setKnown(int i, char c) {
+    struct change* ch = newChange();
+    ch->clet = i;
+    ch->letter = puzzle->known[i];
+
+    puzzle->known[i] = c;
+    markDirty(i);
+}
+
+/**
+ * @brief Put a code word's state on the trail before it is collected again. The trail
+ * takes the code word's arrays and the code word is given copies of them. Its list of
+ * words is shared, as collecting only reorders it or starts a new one
+ */
+void saveCwrd(struct cwrd* cw) {
+    struct change* ch = newChange();
+    ch->cw = cw;
+    ch->dirty = cw->dirty;
+    ch->used = cw->used;
+    ch->best = cw->best;
+    ch->known = cw->known;
+    ch->possible = cw->possible;
+    ch->likelihood = cw->likelihood;
+    ch->words = cw->words;
+    ch->weights = cw->weights;
+    ch->num_words = cw->num_words;
+    ch->words_size = cw->words_size;
+    ch->words_known = cw->words_known;
+    ch->words_exclude = cw->words_exclude;
+
+    cw->known = malloc(cw->len);
+    cw->possible = malloc(cw->len * sizeof(uint32_t));
+    cw->likelihood = malloc(cw->len * 26 * sizeof(double));
+    cw->words_known = malloc(cw->len);
+    if (!cw->known || !cw->possible || !cw->likelihood || !cw->words_known) {
+        perror("Failed to allocate code word");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(cw->known, ch->known, cw->len);
+    memcpy(cw->possible, ch->possible, cw->len * sizeof(uint32_t));
+    memcpy(cw->likelihood, ch->likelihood, cw->len * 26 * sizeof(double));
+    memcpy(cw->words_known, ch->words_known, cw->len);
+}
+
+/**
+ * @brief Undo the changes made since the trail had mark entries, most recent first, so
+ * the state of the search is exactly as it was then. Nothing needs collecting again
+ * @param mark number of entries on the trail to go back to
+ */
+void undo(int mark) {
+    while (trail_num > mark) {
+        struct change* ch = trail + --trail_num;
+        struct cwrd* cw = ch->cw;
+
+        if (!cw) {
+            puzzle->known[ch->clet] = ch->letter;
+            continue;
+        }
+
+        cw->dirty = ch->dirty;
+        if (cw->dirty) {
+            addDirty(cw);
+        }
+        if (!ch->known) {
+            continue;
+        }
+        outdate(cw);
+
+        // Lists read since are freed, lists picked from are the same list
+        if (cw->words != ch->words) {
+            free(cw->words);
+            free(cw->weights);
+        }
+        free(cw->known);
+        free(cw->possible);
+        free(cw->likelihood);
+        free(cw->words_known);
+
+        cw->used = ch->used;
+        cw->best = ch->best;
+        cw->known = ch->known;
+        cw->possible = ch->possible;
+        cw->likelihood = ch->likelihood;
+        cw->words = ch->words;
+        cw->weights = ch->weights;
+        cw->num_words = ch->num_words;
+        cw->words_size = ch->words_size;
+        cw->words_known = ch->words_known;
+        cw->words_exclude = ch->words_exclude;
+    }
+}
+
+/**
+ * @brief Clear a code word's possible letters and fill in its letters the puzzle knows,
+ * ready for collecting
+ */
+void prepareCollect(struct cwrd* cw) {
+    // Reset possibility sets and the weight of each letter
+    for (int i = 0; i < cw->len; i++) {
+        cw->possible[i] = 0;
+    }
+    memset(cw->likelihood, 0, cw->len * 26 * sizeof(double));
+
+    #if DEBUG
+    printf("    filled pattern =");
+    for (int i = 0; i < cw->len; i++) {
+        printf(" %d", cw->known[i]);
+    }
+    printf("\n");
+    #endif
+
+    // Construct pattern
+    for (int i = 0; i < cw->len; i++) {
+        // If the cw doesn't know position i and the puzzel does, move it into the known field
+        if (cw->known[i] == 0 && puzzle->known[cw->clets[i] - 1]) {
+            d("  position=%d code-letter=%d known-value=%d puzzle-known=%d\n",
+                i, cw->known[i], cw->clets[i] - 1, puzzle->known[cw->clets[i] - 1]);
+            
+            cw->known[i] = puzzle->known[cw->clets[i] - 1];
+        }
+    }
+
+    #if DEBUG
     printf("    cw-known-values =");
     for (int i = 0; i < cw->len; i++) {
         printf(" %d", cw->known[i]);
@@ -499,41 +1956,275 @@ void collect(struct cwrd* cw) {
     printf("\n");
     #endif
 
-    // Indicate to datastore that we are now searching using a different pattern
-    newPattern(cw->len, cw->pattern, cw->known);
+    // The words are collected with the letters used now
+    cw->used = used;
+    cw->dirty = 0;
+}
 
-    // Iterate over words matching pattern
-    char *word;
-    while (word = nextWord()) {
-        for (int i = 0; i < cw->len; i++, word++) {
-            // Get ith letter c from word
+/**
+ * @brief Add a word matching a code word to its possible letters
+ * @param word the word, as many letters as the code word
+ * @param weight the word's weight
+ */
+void addWord(struct cwrd* cw, char *word, double weight) {
+    for (int i = 0; i < cw->len; i++, word++) {
+        // Get ith letter c from word
 
-            // Convert to mask
-            uint32_t mask = 0x1 << ((*word) - 'a');
+        // Convert to mask
+        uint32_t mask = 0x1 << ((*word) - 'a');
 
-            // 'or' onto possible[i]
-            cw->possible[i] |= mask;
+        // 'or' onto possible[i]
+        cw->possible[i] |= mask;
+
+        // Add the word's weight to the letter's
+        cw->likelihood[i * 26 + (*word) - 'a'] += weight;
+    }
+}
+
+/**
+ * @brief Finish collecting a code word's possible letters
+ * @param total total weight of the matching words
+ * @param best weight of the heaviest matching word
+ */
+void finishCollect(struct cwrd* cw, double total, double best) {
+    // Code words with no words have nothing to bound the score of a solution with
+    cw->best = best > 0 ? log(best) : -INFINITY;
+
+    // Turn the weights into the log of each letter's share. Letters with no words are not
+    // possible so are left at zero
+    for (int i = 0; i < cw->len * 26; i++) {
+        if (cw->likelihood[i] > 0) {
+            cw->likelihood[i] = log(cw->likelihood[i] / total);
         }
     }
 }
 
+/**
+ * @brief Score the current full solution by the sum of the log weights of its words
+ * @return double the score, or NAN if any code word does not decode to a word
+ */
+double solutionScore() {
+    double score = 0;
+
+    struct cwrd** cs = puzzle->cwrds;
+    struct cwrd* cw;
+    while (cw = *cs) {
+        char decoded[cw->len];
+        for (int i = 0; i < cw->len; i++) {
+            decoded[i] = puzzle->known[cw->clets[i] - 1];
+        }
+
+        cursorBucket(reader, cw->bucket, decoded, 0);
+        if (!cursorNext(reader)) {
+            return NAN;
+        }
+        score += log(cursorWeight(reader));
+
+        cs++;
+    }
+
+    return score;
+}
+
+/**
+ * @brief Add the current full solution to the ranked solutions if it is one of the most
+ * likely found
+ * @param score the solution's score, given by solutionScore
+ */
+void rankSolution(double score) {
+    // The ranked solutions are shared by every thread
+    if (pool) {
+        lockPool(pool);
+    }
+
+    num_found++;
+
+    // Keep the list in order, most likely first
+    if (num_ranked == rank_size && score <= ranked[num_ranked - 1].score) {
+        if (pool) {
+            unlockPool(pool);
+        }
+        return;
+    }
+
+    int at = num_ranked < rank_size ? num_ranked++ : num_ranked - 1;
+    while (at > 0 && ranked[at - 1].score < score) {
+        ranked[at] = ranked[at - 1];
+        at--;
+    }
+
+    ranked[at].score = score;
+    memcpy(ranked[at].known, puzzle->known, 26);
+
+    if (pool) {
+        unlockPool(pool);
+    }
+}
+
+/**
+ * @brief Check whether no solution from the current state can be more likely than the
+ * ranked solutions, which are full
+ */
+char outranked() {
+    if (pool) {
+        lockPool(pool);
+    }
+
+    char beaten = num_ranked == rank_size && bestScore() <= ranked[num_ranked - 1].score;
+
+    if (pool) {
+        unlockPool(pool);
+    }
+    return beaten;
+}
+
+/**
+ * @brief Find the highest score a solution could have from the current state: the sum
+ * of the log weights of the heaviest word matching each code word
+ */
+double bestScore() {
+    double score = 0;
+
+    struct cwrd** cs = puzzle->cwrds;
+    struct cwrd* cw;
+    while (cw = *cs) {
+        score += cw->best;
+        cs++;
+    }
+
+    return score;
+}
+
+/**
+ * @brief Print the ranked solutions and use the most likely as the puzzle's solution
+ * @return char 1 if any solution was found, 0 otherwise
+ */
+char reportRanked() {
+    // Solutions that could not beat those already ranked are not searched, so are not counted
+    printf("Ranked %d of %d solution%s found, most likely first:\n", num_ranked, num_found, num_found == 1 ? "" : "s");
+    for (int i = 0; i < num_ranked; i++) {
+        printf("    %d. ", i + 1);
+        for (int j = 0; j < 26; j++) {
+            printf("%c", ranked[i].known[j] ? ranked[i].known[j] : '.');
+        }
+        printf(" (log weight %.3f)\n", ranked[i].score);
+    }
+
+    if (!num_ranked) {
+        return 0;
+    }
+
+    memcpy(puzzle->known, ranked[0].known, 26);
+    return 1;
+}
+
+/**
+ * @brief Count the current full solution when enumerating the solutions, printing it when
+ * printing every one
+ * @return char 1 once a second solution is found when only finding out whether there is
+ * exactly one, to stop the search, otherwise 0 to keep searching
+ */
+char countSolution() {
+    // The count is shared by every thread
+    if (pool) {
+        lockPool(pool);
+    }
+
+    num_solutions++;
+    if (num_solutions == 1) {
+        memcpy(solution, puzzle->known, 26);
+    }
+
+    if (enumerate == ENUMERATE_ALL) {
+        printf("Solution %" PRIu64 ": ", num_solutions);
+        for (int j = 0; j < 26; j++) {
+            printf("%c", puzzle->known[j] ? puzzle->known[j] : '.');
+        }
+        printf("\n");
+    }
+
+    char stop = enumerate == ENUMERATE_UNIQUE && num_solutions > 1;
+
+    if (pool) {
+        unlockPool(pool);
+        if (stop) {
+            stopPool(pool);
+        }
+    }
+    return stop;
+}
+
+/**
+ * @brief Print the number of solutions found when enumerating them, or whether there is
+ * exactly one, and use the first found as the puzzle's solution
+ * @return char 1 if any solution was found, 0 otherwise
+ */
+char reportSolutions() {
+    if (enumerate == ENUMERATE_UNIQUE) {
+        if (num_solutions == 0) {
+            printf("No solution found\n");
+        } else if (num_solutions == 1) {
+            printf("Solution is unique\n");
+        } else {
+            printf("Solution is not unique\n");
+        }
+    } else {
+        printf("Solutions found: %" PRIu64 "\n", num_solutions);
+    }
+
+    if (!num_solutions) {
+        return 0;
+    }
+
+    memcpy(puzzle->known, solution, 26);
+    return 1;
+}
+
 /**
  * @brief Mark any codewords containing the code letter i as dirty
  * 
  * @param i code letter to search for
  */
 void markDirty(int i) {
-    struct cwrd** cs = puzzle->cwrds;
-    struct cwrd* c;
-    while (c = *cs) {
-        for (int j = 0; j < c->len; j++) {
-            if (i == c->clets[j] - 1) {
-                c->dirty = 1;
-                break;
-            }
+    for (int k = 0; k < puzzle->num_uses[i]; k++) {
+        struct cwrd* c = puzzle->uses[i][k].cw;
+        if (c->dirty) {
+            continue;
         }
 
-        cs++;
+        // Keep the flag on the trail so it can be cleared again
+        struct change* ch = newChange();
+        ch->cw = c;
+        ch->dirty = 0;
+
+        c->dirty = 1;
+        addDirty(c);
+    }
+}
+
+/**
+ * @brief Add a code word to the list of those marked dirty
+ */
+void addDirty(struct cwrd* cw) {
+    if (num_dirtied == dirtied_size) {
+        dirtied_size = dirtied_size ? dirtied_size * 2 : 64;
+        dirtied = realloc(dirtied, dirtied_size * sizeof(struct cwrd*));
+        if (!dirtied) {
+            perror("Failed to allocate dirty code words");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    dirtied[num_dirtied++] = cw;
+}
+
+/**
+ * @brief Note that the code letters of a code word need collating again, as its possible
+ * letters are changing
+ */
+void outdate(struct cwrd* cw) {
+    for (int i = 0; i < cw->len; i++) {
+        outdated |= 0x1 << (cw->clets[i] - 1);
     }
 }
 